@@ -0,0 +1,323 @@
+/****************************************************************************}
+{ main.cpp - throughput benchmark of SimpleCrypt                             }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#include "simplecrypt.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <atomic>
+#include <cstdio>
+#include <random>
+
+#ifdef __GLIBC__
+// Every allocation, including the ones of Qt's containers, ends up in malloc(), calloc() or realloc().
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+static std::atomic<quint64> allocationCounter(0);
+
+extern "C" void* malloc(size_t size)
+{
+    allocationCounter.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    allocationCounter.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    allocationCounter.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+static const bool allocationsCounted = true;
+static quint64 allocations() {return allocationCounter.load(std::memory_order_relaxed);}
+#else
+static const bool allocationsCounted = false;
+static quint64 allocations() {return 0;}
+#endif
+
+struct Measurement
+{
+    qint64 iterations;
+    double nsPerOp;
+    double mbPerSec;
+    double allocsPerOp;
+
+    QJsonObject toJson() const
+    {
+        QJsonObject o;
+        o.insert(QStringLiteral("iterations"), iterations);
+        o.insert(QStringLiteral("nsPerOp"), nsPerOp);
+        o.insert(QStringLiteral("mbPerSec"), mbPerSec);
+        if(allocationsCounted)
+            o.insert(QStringLiteral("allocsPerOp"), allocsPerOp);
+        else
+            o.insert(QStringLiteral("allocsPerOp"), QJsonValue());
+        return o;
+    }
+};
+
+// runs func until minNsecs have passed (at least once); bytes is the payload size for the throughput
+template<typename F>
+static Measurement measure(qint64 bytes, qint64 minNsecs, F func)
+{
+    // small payloads are warmed up, large ones are slow enough on their own
+    if(bytes < 1024 * 1024)
+        func();
+
+    quint64 allocsBefore = allocations();
+    QElapsedTimer timer;
+    timer.start();
+    qint64 iterations = 0;
+    qint64 elapsed;
+    do
+    {
+        func();
+        iterations++;
+        elapsed = timer.nsecsElapsed();
+    }
+    while(elapsed < minNsecs);
+    quint64 allocs = allocations() - allocsBefore;
+
+    Measurement m;
+    m.iterations = iterations;
+    m.nsPerOp = double(elapsed) / iterations;
+    m.mbPerSec = double(bytes) * iterations / (1024.0 * 1024.0) / (double(elapsed) / 1e9);
+    m.allocsPerOp = double(allocs) / iterations;
+    return m;
+}
+
+// a text of random words compresses to about a third, random bytes don't compress at all
+static QByteArray makePayload(const QString& kind, qint64 size)
+{
+    static const char* const words[] = {
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+        "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore", "magna"};
+    std::mt19937_64 rng(size);
+    QByteArray data;
+    data.reserve(int(size));
+    if(kind == QLatin1String("random"))
+    {
+        while(data.size() < size)
+            data.append(char(rng()));
+    }
+    else
+    {
+        while(data.size() < size)
+        {
+            data.append(words[rng() % (sizeof(words) / sizeof(words[0]))]);
+            data.append(rng() % 12 ? ' ' : '\n');
+        }
+        data.truncate(int(size));
+    }
+    return data;
+}
+
+static const char* compressionName(SimpleCrypt::CompressionMode mode)
+{
+    switch(mode)
+    {
+        case SimpleCrypt::CompressionAuto: return "auto";
+        case SimpleCrypt::CompressionAlways: return "always";
+        case SimpleCrypt::CompressionNever: return "never";
+    }
+    return "";
+}
+
+static const char* integrityName(SimpleCrypt::IntegrityProtectionMode mode)
+{
+    switch(mode)
+    {
+        case SimpleCrypt::ProtectionNone: return "none";
+        case SimpleCrypt::ProtectionChecksum: return "checksum";
+        case SimpleCrypt::ProtectionHash: return "hash";
+        case SimpleCrypt::ProtectionCrc32c: return "crc32c";
+        case SimpleCrypt::ProtectionXxh64: return "xxh64";
+        case SimpleCrypt::ProtectionBlake3: return "blake3";
+    }
+    return "";
+}
+
+static const char* codecName(SimpleCrypt::CompressionCodec codec)
+{
+    switch(codec)
+    {
+        case SimpleCrypt::CodecZlib: return "zlib";
+        case SimpleCrypt::CodecZstd: return "zstd";
+        case SimpleCrypt::CodecLz4: return "lz4";
+    }
+    return "";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("SimpleCryptBench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Measures the throughput, the allocations per call and the output size of SimpleCrypt\n"
+        "for all combinations of the compression and integrity protection modes."));
+    parser.addHelpOption();
+    QCommandLineOption outputOption({QStringLiteral("o"), QStringLiteral("output")},
+        QStringLiteral("Write the JSON to <file> instead of stdout."), QStringLiteral("file"));
+    QCommandLineOption minSizeOption(QStringLiteral("min-size"),
+        QStringLiteral("The smallest payload, in bytes (default: 16)."), QStringLiteral("bytes"), QStringLiteral("16"));
+    QCommandLineOption maxSizeOption(QStringLiteral("max-size"),
+        QStringLiteral("The largest payload, in bytes (default: 256 MiB)."), QStringLiteral("bytes"), QString::number(256 * 1024 * 1024));
+    QCommandLineOption maxStringSizeOption(QStringLiteral("max-string-size"),
+        QStringLiteral("The largest payload for the string API, in bytes (default: 64 MiB)."), QStringLiteral("bytes"), QString::number(64 * 1024 * 1024));
+    QCommandLineOption minTimeOption(QStringLiteral("min-time"),
+        QStringLiteral("Run every measurement for at least <ms> milliseconds (default: 100)."), QStringLiteral("ms"), QStringLiteral("100"));
+    QCommandLineOption codecOption(QStringLiteral("codec"),
+        QStringLiteral("zlib, zstd or lz4 (default: zlib)."), QStringLiteral("codec"), QStringLiteral("zlib"));
+    QCommandLineOption levelOption(QStringLiteral("level"),
+        QStringLiteral("The compression level (default: the codec's default)."), QStringLiteral("level"), QStringLiteral("-1"));
+    QCommandLineOption blockSizeOption(QStringLiteral("block-size"),
+        QStringLiteral("Use the block-based format with this block size (default: 0, version 3)."), QStringLiteral("bytes"), QStringLiteral("0"));
+    parser.addOptions({outputOption, minSizeOption, maxSizeOption, maxStringSizeOption,
+                       minTimeOption, codecOption, levelOption, blockSizeOption});
+    parser.process(app);
+
+    qint64 minSize = qMax<qint64>(1, parser.value(minSizeOption).toLongLong());
+    qint64 maxSize = parser.value(maxSizeOption).toLongLong();
+    qint64 maxStringSize = parser.value(maxStringSizeOption).toLongLong();
+    qint64 minNsecs = parser.value(minTimeOption).toLongLong() * 1000000;
+
+    SimpleCrypt crypt(Q_UINT64_C(0x0c2ad4a4acb9f023));
+    SimpleCrypt::CompressionCodec codec = SimpleCrypt::CodecZlib;
+    for(SimpleCrypt::CompressionCodec c : {SimpleCrypt::CodecZlib, SimpleCrypt::CodecZstd, SimpleCrypt::CodecLz4})
+        if(parser.value(codecOption) == QLatin1String(codecName(c)))
+            codec = c;
+    if(!crypt.setCompressionCodec(codec, parser.value(levelOption).toInt()))
+    {
+        fprintf(stderr, "The codec is not available in this build.\n");
+        return 1;
+    }
+    crypt.setBlockSize(parser.value(blockSizeOption).toInt());
+
+    const QList<SimpleCrypt::CompressionMode> compressionModes = {
+        SimpleCrypt::CompressionAuto, SimpleCrypt::CompressionAlways, SimpleCrypt::CompressionNever};
+    const QList<SimpleCrypt::IntegrityProtectionMode> integrityModes = {
+        SimpleCrypt::ProtectionNone, SimpleCrypt::ProtectionChecksum, SimpleCrypt::ProtectionHash,
+        SimpleCrypt::ProtectionCrc32c, SimpleCrypt::ProtectionXxh64, SimpleCrypt::ProtectionBlake3};
+    const QStringList kinds = {QStringLiteral("text"), QStringLiteral("random")};
+
+    QJsonArray results;
+    bool allOk = true;
+    for(qint64 size = minSize; size <= maxSize; size *= 4)
+    {
+        for(const QString& kind : kinds)
+        {
+            QByteArray payload = makePayload(kind, size);
+            bool withStrings = size <= maxStringSize;
+            // the string API encodes the text as UTF-8, so the random bytes are taken as Latin-1
+            QString payloadString = withStrings ? QString::fromLatin1(payload) : QString();
+
+            for(SimpleCrypt::CompressionMode compression : compressionModes)
+            {
+                for(SimpleCrypt::IntegrityProtectionMode integrity : integrityModes)
+                {
+                    crypt.setCompressionMode(compression);
+                    crypt.setIntegrityProtectionMode(integrity);
+
+                    QJsonObject common;
+                    common.insert(QStringLiteral("data"), kind);
+                    common.insert(QStringLiteral("size"), size);
+                    common.insert(QStringLiteral("compression"), QLatin1String(compressionName(compression)));
+                    common.insert(QStringLiteral("integrity"), QLatin1String(integrityName(integrity)));
+
+                    QByteArray cypher;
+                    Measurement enc = measure(size, minNsecs, [&]{cypher = crypt.encryptToByteArray(payload);});
+                    QByteArray plain;
+                    Measurement dec = measure(size, minNsecs, [&]{plain = crypt.decryptToByteArray(cypher);});
+                    bool ok = plain == payload;
+                    QJsonObject bytes = common;
+                    bytes.insert(QStringLiteral("api"), QStringLiteral("bytes"));
+                    bytes.insert(QStringLiteral("outputSize"), cypher.size());
+                    bytes.insert(QStringLiteral("ok"), ok);
+                    bytes.insert(QStringLiteral("encrypt"), enc.toJson());
+                    bytes.insert(QStringLiteral("decrypt"), dec.toJson());
+                    results.append(bytes);
+                    allOk = allOk && ok;
+                    fprintf(stderr, "bytes  %-6s %10lld %-6s %-8s enc %9.1f MB/s  dec %9.1f MB/s%s\n",
+                            qPrintable(kind), size, compressionName(compression), integrityName(integrity),
+                            enc.mbPerSec, dec.mbPerSec, ok ? "" : "  FAILED");
+
+                    if(!withStrings)
+                        continue;
+                    QString cypherString;
+                    enc = measure(size, minNsecs, [&]{cypherString = crypt.encryptToString(payloadString);});
+                    QString plainString;
+                    dec = measure(size, minNsecs, [&]{plainString = crypt.decryptToString(cypherString);});
+                    ok = plainString == payloadString;
+                    QJsonObject strings = common;
+                    strings.insert(QStringLiteral("api"), QStringLiteral("string"));
+                    strings.insert(QStringLiteral("outputSize"), cypherString.size());
+                    strings.insert(QStringLiteral("ok"), ok);
+                    strings.insert(QStringLiteral("encrypt"), enc.toJson());
+                    strings.insert(QStringLiteral("decrypt"), dec.toJson());
+                    results.append(strings);
+                    allOk = allOk && ok;
+                    fprintf(stderr, "string %-6s %10lld %-6s %-8s enc %9.1f MB/s  dec %9.1f MB/s%s\n",
+                            qPrintable(kind), size, compressionName(compression), integrityName(integrity),
+                            enc.mbPerSec, dec.mbPerSec, ok ? "" : "  FAILED");
+                }
+            }
+        }
+    }
+
+    QJsonObject config;
+    config.insert(QStringLiteral("codec"), QLatin1String(codecName(crypt.compressionCodec())));
+    config.insert(QStringLiteral("level"), crypt.compressionLevel());
+    config.insert(QStringLiteral("blockSize"), crypt.blockSize());
+    config.insert(QStringLiteral("minTimeMs"), minNsecs / 1000000);
+    config.insert(QStringLiteral("threads"), QThread::idealThreadCount());
+    config.insert(QStringLiteral("qtVersion"), QLatin1String(qVersion()));
+    config.insert(QStringLiteral("allocationsCounted"), allocationsCounted);
+
+    QJsonObject root;
+    root.insert(QStringLiteral("config"), config);
+    root.insert(QStringLiteral("results"), results);
+    QByteArray json = QJsonDocument(root).toJson();
+
+    if(parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size())
+        {
+            fprintf(stderr, "Cannot write %s\n", qPrintable(file.fileName()));
+            return 1;
+        }
+    }
+    else
+    {
+        fwrite(json.constData(), 1, size_t(json.size()), stdout);
+    }
+
+    return allOk ? 0 : 2;
+}
@@ -0,0 +1,259 @@
+/****************************************************************************}
+{ csvreader.cpp - streaming CSV/TSV parser                                   }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#include "csvreader.h"
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+static const int blockSize = 64;
+
+static inline quint64 charMask64(const char* p, char c)
+{
+#ifdef __SSE2__
+    const __m128i v = _mm_set1_epi8(c);
+    quint64 m0 = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), v)));
+    quint64 m1 = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)), v)));
+    quint64 m2 = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32)), v)));
+    quint64 m3 = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48)), v)));
+    return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#else
+    quint64 m = 0;
+    for(int a=0; a<blockSize; a++)
+        if(p[a] == c)
+            m |= quint64(1) << a;
+    return m;
+#endif
+}
+
+// bit i of the result is the XOR of the bits 0..i of x
+static inline quint64 prefixXor(quint64 x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+CsvReader::CsvReader(QIODevice *device, char delimiter, char quote, int bufferSize)
+    :device(device)
+    ,delim(delimiter)
+    ,quote(quote)
+    ,buf(qMax(bufferSize, blockSize * 2), Qt::Uninitialized)
+    ,dataEnd(0)
+    ,rowStart(0)
+    ,fieldStart(0)
+    ,scanPos(0)
+    ,inQuote(false)
+    ,eof(false)
+    ,failed(false)
+    ,rows(0)
+    ,blockPos(-1)
+    ,blockLen(0)
+    ,blockSeparators(0)
+    ,blockNewlines(0)
+{
+}
+
+bool CsvReader::readRow()
+{
+    if(failed)
+        return false;
+
+    fields.clear();
+    rowStart = scanPos;
+    fieldStart = scanPos;
+
+    forever
+    {
+        if(blockSeparators)
+        {
+            int bit = qCountTrailingZeroBits(blockSeparators);
+            blockSeparators &= blockSeparators - 1;
+            int pos = blockPos + bit;
+            bool newline = (blockNewlines >> bit) & 1;
+            scanPos = pos + 1;
+            if(newline && fields.isEmpty() && (pos == fieldStart || (pos == fieldStart + 1 && buf.at(fieldStart) == '\r')))
+            {
+                rowStart = scanPos;
+                fieldStart = scanPos;
+                continue;
+            }
+            addField(pos, newline);
+            fieldStart = scanPos;
+            if(newline)
+            {
+                rows++;
+                return true;
+            }
+            continue;
+        }
+
+        if(blockPos >= 0)
+        {
+            scanPos = blockPos + blockLen;
+            blockPos = -1;
+        }
+
+        if(dataEnd - scanPos < blockSize && !eof)
+        {
+            if(!fill())
+                return false;
+            continue;
+        }
+
+        if(scanPos >= dataEnd)
+        {
+            if(inQuote)
+            {
+                failed = true;
+                SETERROR(Err::unterminatedQuote, QString::number(rows + 1));
+                return false;
+            }
+            if(fields.isEmpty() && fieldStart == dataEnd)
+                return false;
+            addField(dataEnd, true);
+            fieldStart = dataEnd;
+            rows++;
+            return true;
+        }
+
+        classify();
+    }
+}
+
+QByteArrayList CsvReader::row() const
+{
+    QByteArrayList list;
+    list.reserve(fields.size());
+    for(int a=0; a<fields.size(); a++)
+        list.append(field(a));
+    return list;
+}
+
+QString CsvReader::errorCodeToString(Err errorCode)
+{
+    switch(errorCode)
+    {
+        case Err::readDevice: return QStringLiteral("Cannot read from the device");
+        case Err::unterminatedQuote: return QStringLiteral("Unterminated quoted field in row");
+    }
+    return QString();
+}
+
+bool CsvReader::fill()
+{
+    // only the current row has to be kept
+    if(rowStart)
+    {
+        memmove(buf.data(), buf.constData() + rowStart, static_cast<size_t>(dataEnd - rowStart));
+        dataEnd -= rowStart;
+        fieldStart -= rowStart;
+        scanPos -= rowStart;
+        rowStart = 0;
+    }
+    if(dataEnd == buf.size())
+        buf.resize(buf.size() * 2);
+
+    forever
+    {
+        qint64 n = device->read(buf.data() + dataEnd, buf.size() - dataEnd);
+        if(n > 0)
+        {
+            dataEnd += static_cast<int>(n);
+            return true;
+        }
+        // atEnd() of a socket or a process is true whenever its buffer is empty,
+        // so only a failed wait means the end of the data
+        if(n == 0 && device->isSequential() && device->waitForReadyRead(-1))
+            continue;
+        if(n < 0 && !device->atEnd())
+        {
+            failed = true;
+            SETERROR(Err::readDevice, device->errorString());
+            return false;
+        }
+        eof = true;
+        return true;
+    }
+}
+
+void CsvReader::classify()
+{
+    const char* p = buf.constData() + scanPos;
+    blockPos = scanPos;
+    blockLen = qMin(blockSize, dataEnd - scanPos);
+    char padded[blockSize];
+    if(blockLen < blockSize)
+    {
+        // only at the end of the data; the padding bits are masked out below
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, p, static_cast<size_t>(blockLen));
+        p = padded;
+    }
+
+    quint64 quotes = charMask64(p, quote);
+    quint64 quoted = prefixXor(quotes);
+    if(inQuote)
+        quoted = ~quoted;
+    quint64 valid = blockLen == blockSize ? ~quint64(0) : (quint64(1) << blockLen) - 1;
+    inQuote = (quoted >> (blockLen - 1)) & 1;
+
+    blockNewlines = charMask64(p, '\n') & ~quoted & valid;
+    blockSeparators = (charMask64(p, delim) & ~quoted & valid) | blockNewlines;
+}
+
+void CsvReader::addField(int end, bool lastInRow)
+{
+    char* d = buf.data();
+    if(lastInRow && end > fieldStart && d[end - 1] == '\r')
+        end--;
+
+    int size = end - fieldStart;
+    if(size && d[fieldStart] == quote)
+    {
+        // unquote in place: "a""b" -> a"b; anything after the closing quote is kept as is
+        int src = fieldStart + 1;
+        int dst = fieldStart;
+        while(src < end)
+        {
+            const char* q = static_cast<const char*>(memchr(d + src, quote, static_cast<size_t>(end - src)));
+            int n = q ? static_cast<int>(q - d) - src : end - src;
+            memmove(d + dst, d + src, static_cast<size_t>(n));
+            dst += n;
+            src += n;
+            if(!q)
+                break;
+            if(src + 1 < end && d[src + 1] == quote)
+            {
+                d[dst++] = quote;
+                src += 2;
+                continue;
+            }
+            src++;
+            n = end - src;
+            memmove(d + dst, d + src, static_cast<size_t>(n));
+            dst += n;
+            break;
+        }
+        size = dst - fieldStart;
+    }
+    fields.append({fieldStart - rowStart, size});
+}
@@ -0,0 +1,85 @@
+/****************************************************************************}
+{ csvreader.h - streaming CSV/TSV parser                                     }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#pragma once
+
+#include "errormanager.h"
+
+// Reads delimiter-separated rows from a device.
+// Quotes, delimiters and newlines are located 64 bytes at a time with bit masks,
+// the quoted regions are found with a prefix XOR over the quote mask.
+// Quoted fields may contain delimiters, newlines and doubled quotes; "\r\n" line ends are accepted.
+// Empty lines are skipped.
+// The fields are views into an internal buffer, valid until the next readRow() call.
+class CsvReader
+{
+    Q_GADGET
+
+public:
+    enum class Err {
+        readDevice = 1,
+        unterminatedQuote
+    };
+    Q_ENUM(Err)
+
+    static const int defaultBufferSize = 1024 * 1024;
+
+    explicit CsvReader(QIODevice* device, char delimiter = ',', char quote = '"', int bufferSize = defaultBufferSize);
+
+    // returns false at the end of the data or on error (see hasError())
+    bool readRow();
+
+    inline int fieldCount() const {return fields.size();}
+    inline const char* fieldData(int index) const {return buf.constData() + rowStart + fields.at(index).offset;}
+    inline int fieldSize(int index) const {return fields.at(index).size;}
+    inline QByteArray field(int index) const {return QByteArray::fromRawData(fieldData(index), fieldSize(index));}
+    QByteArrayList row() const;
+
+    inline qint64 rowNumber() const {return rows;}
+    inline bool hasError() const {return failed;}
+
+    static QString errorCodeToString(Err errorCode);
+
+protected:
+    struct Field {
+        int offset;
+        int size;
+    };
+
+    QIODevice* device;
+    char delim;
+    char quote;
+    QByteArray buf;
+    int dataEnd;
+    int rowStart;
+    int fieldStart;
+    int scanPos;
+    bool inQuote;
+    bool eof;
+    bool failed;
+    qint64 rows;
+    QVector<Field> fields;
+
+    // the classified block starting at blockPos; consumed bits are cleared from blockSeparators
+    int blockPos;
+    int blockLen;
+    quint64 blockSeparators;
+    quint64 blockNewlines;
+
+    bool fill();
+    void classify();
+    void addField(int end, bool lastInRow);
+};
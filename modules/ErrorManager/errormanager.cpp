@@ -15,11 +15,276 @@
 {****************************************************************************/
 
 #include "errormanager.h"
-#include "common_defines.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 
 ErrorManager* ErrorManager::errMan = nullptr;
 thread_local ErrorManager::ErrorStruct ErrorManager::lastErrorStruct;
 
+namespace {
+
+qint64 steadyNsecs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// a copy of ErrorStruct without anything that allocates
+struct HistoryRecord
+{
+    qint64 timestamp;
+    const ErrorManager::SourceLocation* location;
+    const void* sender;
+    const std::type_info* senderTypeInfo;
+    const std::type_info* codeTypeInfo;
+    QMetaEnum (*codeMetaEnum)();
+    QString (*codeFormatter)(int);
+    ErrorManager::ErrorData::Formatter dataFormatter;
+    qint64 dataNum;
+    const char* sourceFile;
+    const char* funcSig;
+    int sourceLine;
+    int errorVal;
+    int dataLength;
+    bool isException;
+    ushort data[ErrorManager::historyDataLength];
+};
+
+// A single writer (the owning thread) and any number of readers.
+// Every slot is a seqlock: 2n+1 while record n is written, 2n+2 when it's complete.
+struct HistoryRing
+{
+    struct Slot
+    {
+        std::atomic<quint64> seq {0};
+        HistoryRecord record;
+    };
+
+    quintptr threadId {};
+    QString threadName;
+    std::atomic<quint64> head {0};
+    Slot slots[ErrorManager::historySize];
+
+    void push(const HistoryRecord& record)
+    {
+        quint64 n = head.load(std::memory_order_relaxed);
+        Slot& slot = slots[n % ErrorManager::historySize];
+        slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&slot.record, &record, sizeof(record));
+        slot.seq.store(2 * n + 2, std::memory_order_release);
+        head.store(n + 1, std::memory_order_release);
+    }
+
+    // false if the record has been overwritten in the meantime
+    bool read(quint64 n, HistoryRecord& record) const
+    {
+        const Slot& slot = slots[n % ErrorManager::historySize];
+        if(slot.seq.load(std::memory_order_acquire) != 2 * n + 2)
+            return false;
+        std::memcpy(&record, &slot.record, sizeof(record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.seq.load(std::memory_order_relaxed) == 2 * n + 2;
+    }
+};
+
+// the rings of the running threads; the mutex is only taken on thread start/exit and by history()
+struct HistoryRegistry
+{
+    QMutex mutex;
+    QVector<HistoryRing*> rings;
+};
+
+HistoryRegistry& historyRegistry()
+{
+    // never destroyed, threads may exit after the static destructors
+    static HistoryRegistry* registry = new HistoryRegistry;
+    return *registry;
+}
+
+struct HistoryRingHolder
+{
+    HistoryRing* ring {};
+
+    ~HistoryRingHolder()
+    {
+        if(!ring)
+            return;
+        HistoryRegistry& registry = historyRegistry();
+        QMutexLocker lock(&registry.mutex);
+        registry.rings.removeOne(ring);
+        delete ring;
+    }
+};
+
+thread_local HistoryRingHolder historyRingHolder;
+
+HistoryRing* currentHistoryRing()
+{
+    if(!historyRingHolder.ring)
+    {
+        HistoryRing* ring = new HistoryRing;
+        ring->threadId = reinterpret_cast<quintptr>(QThread::currentThreadId());
+        ring->threadName = QThread::currentThread()->objectName();
+        HistoryRegistry& registry = historyRegistry();
+        QMutexLocker lock(&registry.mutex);
+        registry.rings.append(ring);
+        historyRingHolder.ring = ring;
+    }
+    return historyRingHolder.ring;
+}
+
+const int counterMaxProbes = 32;
+const int reportIntervalMsecs = 250;
+
+std::atomic<int> rateLimitBurst {10};
+std::atomic<qint64> rateLimitWindow {1000000000};
+// set by the first suppressed error, cleared by the timer when nothing is left to report
+std::atomic<bool> reportTimerArmed {false};
+
+struct CounterSlot
+{
+    // 0 - empty, 1 - the key is being written, 2 - ready
+    std::atomic<int> state {0};
+    quint32 hash {};
+    const char* sourceFile {};
+    int sourceLine {};
+    int errorVal {};
+    const std::type_info* codeTypeInfo {};
+    // the rest of the first error, to rebuild an ErrorStruct for reports
+    bool isException {};
+    const std::type_info* senderTypeInfo {};
+    const ErrorManager::SourceLocation* location {};
+    const char* funcSig {};
+    QMetaEnum (*codeMetaEnum)() {};
+    QString (*codeFormatter)(int) {};
+
+    std::atomic<quint64> count {0};
+    std::atomic<quint64> suppressed {0};
+    std::atomic<int> emitted {0};
+    std::atomic<qint64> windowStart {0};
+};
+
+CounterSlot counterTable[ErrorManager::errorCounterTableSize];
+
+quint32 counterHash(const ErrorManager::ErrorStruct& err)
+{
+    // file names are compared by contents, so only the numbers are hashed
+    quint32 h = quint32(err.sourceLine) * 0x9e3779b1u ^ quint32(err.errorVal) * 0x85ebca6bu;
+    return h ^ (h >> 15);
+}
+
+bool counterMatches(const CounterSlot& slot, const ErrorManager::ErrorStruct& err)
+{
+    if(slot.sourceLine != err.sourceLine || slot.errorVal != err.errorVal)
+        return false;
+    if(slot.sourceFile != err.sourceFile
+       && (!slot.sourceFile || !err.sourceFile || std::strcmp(slot.sourceFile, err.sourceFile)))
+        return false;
+    if(slot.codeTypeInfo == err.codeTypeInfo)
+        return true;
+    return slot.codeTypeInfo && err.codeTypeInfo
+        && std::type_index(*slot.codeTypeInfo) == std::type_index(*err.codeTypeInfo);
+}
+
+CounterSlot* findCounter(const ErrorManager::ErrorStruct& err, QString (*codeFormatter)(int))
+{
+    quint32 hash = counterHash(err);
+    for(int i = 0; i < counterMaxProbes; i++)
+    {
+        CounterSlot& slot = counterTable[(hash + quint32(i)) % ErrorManager::errorCounterTableSize];
+        int state = slot.state.load(std::memory_order_acquire);
+        if(state == 0)
+        {
+            if(slot.state.compare_exchange_strong(state, 1, std::memory_order_acquire))
+            {
+                slot.hash = hash;
+                slot.sourceFile = err.sourceFile;
+                slot.sourceLine = err.sourceLine;
+                slot.errorVal = err.errorVal;
+                slot.codeTypeInfo = err.codeTypeInfo;
+                slot.isException = err.isException;
+                slot.senderTypeInfo = err.senderTypeInfo;
+                slot.location = err.location;
+                slot.funcSig = err.funcSig;
+                slot.codeMetaEnum = err.codeMetaEnum;
+                slot.codeFormatter = codeFormatter;
+                slot.state.store(2, std::memory_order_release);
+                return &slot;
+            }
+        }
+        // another thread is writing the key, it's only a few stores
+        while(state == 1)
+        {
+            QThread::yieldCurrentThread();
+            state = slot.state.load(std::memory_order_acquire);
+        }
+        if(slot.hash == hash && counterMatches(slot, err))
+            return &slot;
+    }
+    return nullptr;
+}
+
+ErrorManager::ErrorStruct counterError(const CounterSlot& slot)
+{
+    ErrorManager::ErrorStruct err;
+    err.isException = slot.isException;
+    err.senderTypeInfo = slot.senderTypeInfo;
+    err.location = slot.location;
+    err.sourceFile = slot.sourceFile;
+    err.funcSig = slot.funcSig;
+    err.sourceLine = slot.sourceLine;
+    err.errorVal = slot.errorVal;
+    err.codeTypeInfo = slot.codeTypeInfo;
+    err.codeMetaEnum = slot.codeMetaEnum;
+    err.description = ErrorManager::Description(slot.codeFormatter, slot.errorVal, ErrorManager::ErrorData());
+    return err;
+}
+
+// false if the error must not be emitted; suppressed gets the number of the errors not reported yet
+bool countError(const ErrorManager::ErrorStruct& err, QString (*codeFormatter)(int), quint64& suppressed)
+{
+    suppressed = 0;
+    CounterSlot* slot = findCounter(err, codeFormatter);
+    if(!slot)
+        return true;
+    slot->count.fetch_add(1, std::memory_order_relaxed);
+
+    int burst = rateLimitBurst.load(std::memory_order_relaxed);
+    if(burst <= 0)
+        return true;
+
+    // the limit is approximate when several threads hit the start of a window at once
+    qint64 now = steadyNsecs();
+    qint64 start = slot->windowStart.load(std::memory_order_relaxed);
+    if(now - start >= rateLimitWindow.load(std::memory_order_relaxed)
+       && slot->windowStart.compare_exchange_strong(start, now, std::memory_order_relaxed))
+    {
+        slot->emitted.store(0, std::memory_order_relaxed);
+        suppressed = slot->suppressed.exchange(0, std::memory_order_relaxed);
+    }
+    if(slot->emitted.fetch_add(1, std::memory_order_relaxed) < burst)
+        return true;
+    // seq_cst pairs with the check in ErrorManager::timerEvent(), so either the timer sees this count
+    // or the caller sees that the timer has to be started again
+    slot->suppressed.fetch_add(1);
+    return false;
+}
+
+bool hasSuppressed()
+{
+    for(const CounterSlot& slot : counterTable)
+    {
+        if(slot.state.load(std::memory_order_acquire) == 2 && slot.suppressed.load())
+            return true;
+    }
+    return false;
+}
+
+}
+
 void ErrorManager::createInstance()
 {
     if(!errMan)
@@ -32,39 +297,245 @@ ErrorManager::~ErrorManager()
 }
 
 ErrorManager::ErrorManager()
+    :reportTimerId(0)
 {
     qRegisterMetaType<ErrorManager::ErrorStruct>("ErrorManager::ErrorStruct");
 }
 
-QString ErrorManager::ErrorStruct::logLine() const
+void ErrorManager::setError(const ErrorStruct& err)
+{
+    static const QMetaMethod onErrorSignal = QMetaMethod::fromSignal(&ErrorManager::onError);
+
+    lastErrorStruct = err;
+    errno = err.errorVal | errnoMask;
+    addToHistory(err);
+    quint64 suppressed;
+    bool emitError = countError(err, err.description.codeFormatter, suppressed);
+    if(!emitError && !reportTimerArmed.load() && !reportTimerArmed.exchange(true))
+        QMetaObject::invokeMethod(this, "startReportTimer", Qt::QueuedConnection);
+    if(emitError && isSignalConnected(onErrorSignal))
+    {
+        if(suppressed)
+        {
+            ErrorStruct reported = err;
+            reported.suppressedCount = suppressed;
+            emit onError(reported);
+        }
+        else
+        {
+            emit onError(err);
+        }
+    }
+    if(err.isException)
+        throw Exception(err);
+}
+
+void ErrorManager::addToHistory(const ErrorStruct& err)
+{
+    HistoryRecord record;
+    record.timestamp = steadyNsecs();
+    record.location = err.location;
+    record.sender = err.sender;
+    record.senderTypeInfo = err.senderTypeInfo;
+    record.codeTypeInfo = err.codeTypeInfo;
+    record.codeMetaEnum = err.codeMetaEnum;
+    record.codeFormatter = err.description.codeFormatter;
+    record.dataFormatter = err.description.data.formatter;
+    record.dataNum = err.description.data.num;
+    record.sourceFile = err.sourceFile;
+    record.funcSig = err.funcSig;
+    record.sourceLine = err.sourceLine;
+    record.errorVal = err.errorVal;
+    record.isException = err.isException;
+    const QString& str = err.description.data.str;
+    record.dataLength = str.size() < historyDataLength ? str.size() : historyDataLength;
+    std::memcpy(record.data, str.utf16(), static_cast<size_t>(record.dataLength) * sizeof(ushort));
+    currentHistoryRing()->push(record);
+}
+
+QVector<ErrorManager::HistoryEntry> ErrorManager::history()
+{
+    qint64 nowSteady = steadyNsecs();
+    qint64 nowMsecs = QDateTime::currentMSecsSinceEpoch();
+
+    // sorted by the steady clock, the wall clock has a too coarse resolution
+    QVector<QPair<qint64, HistoryEntry>> entries;
+    HistoryRegistry& registry = historyRegistry();
+    QMutexLocker lock(&registry.mutex);
+    for(const HistoryRing* ring : qAsConst(registry.rings))
+    {
+        quint64 head = ring->head.load(std::memory_order_acquire);
+        quint64 n = head > quint64(historySize) ? head - historySize : 0;
+        for(; n < head; n++)
+        {
+            HistoryRecord record;
+            if(!ring->read(n, record))
+                continue;
+
+            HistoryEntry entry;
+            entry.threadId = ring->threadId;
+            entry.threadName = ring->threadName;
+            entry.msecsSinceEpoch = nowMsecs - (nowSteady - record.timestamp) / 1000000;
+            ErrorStruct& err = entry.error;
+            err.isException = record.isException;
+            err.sender = record.sender;
+            err.senderTypeInfo = record.senderTypeInfo;
+            err.location = record.location;
+            err.sourceFile = record.sourceFile;
+            err.funcSig = record.funcSig;
+            err.sourceLine = record.sourceLine;
+            err.errorVal = record.errorVal;
+            err.codeTypeInfo = record.codeTypeInfo;
+            err.codeMetaEnum = record.codeMetaEnum;
+            err.description = Description(
+                        record.codeFormatter,
+                        record.errorVal,
+                        ErrorData(record.dataFormatter, QString::fromUtf16(record.data, record.dataLength), record.dataNum));
+            entries.append(qMakePair(record.timestamp, entry));
+        }
+    }
+    lock.unlock();
+
+    std::stable_sort(entries.begin(), entries.end(), [](const QPair<qint64, HistoryEntry>& a, const QPair<qint64, HistoryEntry>& b){
+        return a.first < b.first;
+    });
+    QVector<HistoryEntry> result;
+    result.reserve(entries.size());
+    for(const auto& entry : qAsConst(entries))
+        result.append(entry.second);
+    return result;
+}
+
+void ErrorManager::setRateLimit(int burst, int windowMsecs)
+{
+    rateLimitBurst.store(burst, std::memory_order_relaxed);
+    rateLimitWindow.store(qint64(windowMsecs) * 1000000, std::memory_order_relaxed);
+}
+
+QVector<ErrorManager::ErrorCounter> ErrorManager::errorCounters()
+{
+    QVector<ErrorCounter> counters;
+    for(const CounterSlot& slot : counterTable)
+    {
+        if(slot.state.load(std::memory_order_acquire) != 2)
+            continue;
+        ErrorCounter counter;
+        counter.error = counterError(slot);
+        counter.count = slot.count.load(std::memory_order_relaxed);
+        counter.suppressedCount = slot.suppressed.load(std::memory_order_relaxed);
+        counters.append(counter);
+    }
+    return counters;
+}
+
+void ErrorManager::timerEvent(QTimerEvent* event)
+{
+    Q_UNUSED(event);
+    if(reportSuppressed())
+        return;
+    killTimer(reportTimerId);
+    reportTimerId = 0;
+    reportTimerArmed.store(false);
+    // an error suppressed meanwhile may have seen the flag still set
+    if(hasSuppressed() && !reportTimerArmed.exchange(true))
+        startReportTimer();
+}
+
+void ErrorManager::startReportTimer()
 {
-    QRegularExpression rx("((?:\\w+\\:\\:)?\\w+)\\(");
-    QRegularExpressionMatch match = rx.match(QString(funcSig));
-    QString fSig;
-    QString errText(errorScope);
-    if(match.hasMatch())
+    if(!reportTimerId)
+        reportTimerId = startTimer(reportIntervalMsecs);
+}
+
+// the errors suppressed in the windows that have passed, in case the same error doesn't come again;
+// returns false if there is nothing left to report later
+bool ErrorManager::reportSuppressed()
+{
+    static const QMetaMethod onErrorSignal = QMetaMethod::fromSignal(&ErrorManager::onError);
+
+    qint64 now = steadyNsecs();
+    qint64 window = rateLimitWindow.load(std::memory_order_relaxed);
+    bool pending = false;
+    for(CounterSlot& slot : counterTable)
     {
-        fSig = match.captured(1);
-        QStringList fSigParts = fSig.split("::");
-        if(!fSigParts.isEmpty())
-            fSigParts.removeLast();
-        QStringList errScopeParts = errText.split("::");
-        for(const QString& part : qAsConst(fSigParts))
+        if(slot.state.load(std::memory_order_acquire) != 2)
+            continue;
+        if(!slot.suppressed.load(std::memory_order_relaxed))
+            continue;
+        if(now - slot.windowStart.load(std::memory_order_relaxed) < window)
         {
-            if(errScopeParts.isEmpty())
-                break;
-            if(errScopeParts.first() == part)
-                errScopeParts.removeFirst();
+            pending = true;
+            continue;
         }
-        errText = errScopeParts.join("::");
+        quint64 suppressed = slot.suppressed.exchange(0, std::memory_order_relaxed);
+        if(!suppressed || !isSignalConnected(onErrorSignal))
+            continue;
+        ErrorStruct err = counterError(slot);
+        err.suppressedCount = suppressed;
+        emit onError(err);
+    }
+    return pending;
+}
+
+QString ErrorManager::Description::toString() const
+{
+    if(!codeFormatter)
+        return data.toString();
+    QString errorString = codeFormatter(errorVal);
+    if(errorString.isEmpty())
+        return errorString;
+    return getDescription(errorString, data.toString());
+}
+
+const char* ErrorManager::ErrorStruct::errorScope() const
+{
+    return codeMetaEnum ? codeMetaEnum().scope() : nullptr;
+}
+
+const char* ErrorManager::ErrorStruct::errorName() const
+{
+    return codeMetaEnum ? codeMetaEnum().valueToKey(errorVal) : nullptr;
+}
+
+static inline QLatin1String latin1View(std::string_view s)
+{
+    return QLatin1String(s.data(), static_cast<int>(s.size()));
+}
+
+QString ErrorManager::ErrorStruct::logLine() const
+{
+    static const SourceLocation noLocation;
+    const SourceLocation& loc = location ? *location : noLocation;
+
+    // drop the class of the function from the enum's scope, e.g. "FastHash::hashFile - openFile"
+    const char* scopeStr = errorScope();
+    std::string_view scope(scopeStr ? scopeStr : "");
+    if(!loc.funcScope.empty() && scope.substr(0, loc.funcScope.size()) == loc.funcScope)
+    {
+        std::string_view rest = scope.substr(loc.funcScope.size());
+        if(rest.empty())
+            scope = rest;
+        else if(rest.substr(0, 2) == "::")
+            scope = rest.substr(2);
+    }
+
+    QString path;
+    if(location)
+    {
+        for(int i = 0; i < loc.relativeFileUps; i++)
+            path.append(QLatin1String("../"));
+        path.append(QString::fromUtf8(loc.relativeFile.data(), static_cast<int>(loc.relativeFile.size())));
     }
-    if(!errText.isEmpty())
-        errText = errText + "::" + errorName;
     else
-        errText = errorName;
+    {
+        path = QString::fromUtf8(sourceFile);
+    }
 
-    QString line = QStringLiteral("[") % fSig % " - " % errText % "] "
-                    % description
-                    % " [" % QDir(SOURCE_ROOT).relativeFilePath(sourceFile) % ":" % QString::number(sourceLine) % "]";
+    QString line = QLatin1Char('[') % latin1View(loc.funcName) % QLatin1String(" - ")
+                    % latin1View(scope) % QLatin1String(scope.empty() ? "" : "::") % QLatin1String(errorName())
+                    % QLatin1String("] ") % description.toString()
+                    % QLatin1String(" [") % path % QLatin1Char(':') % QString::number(sourceLine) % QLatin1Char(']');
+    if(suppressedCount)
+        line += QLatin1String(" (") % QString::number(suppressedCount) % QLatin1String(" more occurrences)");
     return line;
 }
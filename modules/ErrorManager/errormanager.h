@@ -16,15 +16,28 @@
 
 #pragma once
 
+#include "common_defines.h"
 #include <QtCore>
 #include <cerrno>
 #include <stdexcept>
+#include <string_view>
+#include <type_traits>
 #include <typeindex>
 
-#define SETERROR(err, ...) ErrorManager::setError(false, this, typeid(this), __FILE__, __PRETTY_FUNCTION__, __LINE__, err, errorCodeToString(err), ## __VA_ARGS__)
-#define SETERROR_S(type, err, ...) ErrorManager::setError(false, nullptr, typeid(type*), __FILE__, __PRETTY_FUNCTION__, __LINE__, err,  errorCodeToString(err), ## __VA_ARGS__)
-#define SETERROR_E(err, ...) ErrorManager::setError(true, this, typeid(this), __FILE__, __PRETTY_FUNCTION__, __LINE__, err,  errorCodeToString(err), ## __VA_ARGS__)
-#define SETERROR_ES(type, err, ...) ErrorManager::setError(true, nullptr, typeid(type*), __FILE__, __PRETTY_FUNCTION__, __LINE__, err, errorCodeToString(err), ## __VA_ARGS__)
+// the description is formatted from these ingredients only when it's read
+#define ERRORMANAGER_CODE_FORMATTER(err) [](int errorVal){return errorCodeToString(static_cast<std::decay_t<decltype(err)>>(errorVal));}
+
+// the location is parsed at compile time, once per SETERROR
+#define ERRORMANAGER_SETERROR(isException, sender, senderTypeInfo, err, ...) \
+    do { \
+        static constexpr ErrorManager::SourceLocation errorManagerLocation(__FILE__, __PRETTY_FUNCTION__, __LINE__); \
+        ErrorManager::setError(isException, sender, senderTypeInfo, errorManagerLocation, err, ERRORMANAGER_CODE_FORMATTER(err), ## __VA_ARGS__); \
+    } while(false)
+
+#define SETERROR(err, ...) ERRORMANAGER_SETERROR(false, this, typeid(this), err, ## __VA_ARGS__)
+#define SETERROR_S(type, err, ...) ERRORMANAGER_SETERROR(false, nullptr, typeid(type*), err, ## __VA_ARGS__)
+#define SETERROR_E(err, ...) ERRORMANAGER_SETERROR(true, this, typeid(this), err, ## __VA_ARGS__)
+#define SETERROR_ES(type, err, ...) ERRORMANAGER_SETERROR(true, nullptr, typeid(type*), err, ## __VA_ARGS__)
 
 #define CHECK(s, err, ...) {if(!(s)) {SETERROR(err, ## __VA_ARGS__); return false;}}
 #define CHECKV(s, err, ...) {if(!(s)) {SETERROR(err, ## __VA_ARGS__); return;}}
@@ -54,19 +67,168 @@ class ErrorManager : public QObject
     Q_OBJECT
 
 public:
+    // __FILE__ and __PRETTY_FUNCTION__ of a SETERROR, processed at compile time
+    struct SourceLocation
+    {
+        const char* file {};
+        const char* funcSig {};
+        int line {};
+        std::string_view funcName; // "Class::method", without the return type and the arguments
+        std::string_view funcScope; // "Class"
+        std::string_view relativeFile; // relative to SOURCE_ROOT after relativeFileUps times "../"
+        int relativeFileUps {};
+
+        constexpr SourceLocation() = default;
+        constexpr SourceLocation(const char* file, const char* funcSig, int line):
+            file(file),
+            funcSig(funcSig),
+            line(line)
+        {
+            std::string_view sig(funcSig);
+            for(size_t i = 1; i < sig.size(); i++)
+            {
+                if(sig[i] != '(' || !isWordChar(sig[i - 1]))
+                    continue;
+                size_t start = wordStart(sig, i - 1);
+                if(start >= 3 && sig[start - 1] == ':' && sig[start - 2] == ':' && isWordChar(sig[start - 3]))
+                {
+                    size_t scopeStart = wordStart(sig, start - 3);
+                    funcScope = sig.substr(scopeStart, start - 2 - scopeStart);
+                    start = scopeStart;
+                }
+                funcName = sig.substr(start, i - start);
+                break;
+            }
+
+            std::string_view path(file);
+            std::string_view root(SOURCE_ROOT);
+            relativeFile = path;
+            if(!isAbsolute(path) || !isAbsolute(root))
+                return;
+            size_t p = 0;
+            size_t r = 0;
+            bool first = true;
+            for(;;)
+            {
+                p = skipSeparators(path, p);
+                r = skipSeparators(root, r);
+                if(r == root.size())
+                    break;
+                size_t pEnd = componentEnd(path, p);
+                size_t rEnd = componentEnd(root, r);
+                if(path.substr(p, pEnd - p) != root.substr(r, rEnd - r))
+                {
+                    // different drives
+                    if(first && path[0] != '/')
+                        return;
+                    break;
+                }
+                p = pEnd;
+                r = rEnd;
+                first = false;
+            }
+            for(; r < root.size(); r = skipSeparators(root, componentEnd(root, r)))
+                relativeFileUps++;
+            relativeFile = path.substr(p);
+        }
+
+    protected:
+        static constexpr bool isWordChar(char c)
+        {
+            return c == '_' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        }
+
+        static constexpr bool isSeparator(char c)
+        {
+            return c == '/' || c == '\\';
+        }
+
+        static constexpr size_t wordStart(std::string_view s, size_t pos)
+        {
+            while(pos > 0 && isWordChar(s[pos - 1]))
+                pos--;
+            return pos;
+        }
+
+        static constexpr size_t skipSeparators(std::string_view s, size_t pos)
+        {
+            while(pos < s.size() && isSeparator(s[pos]))
+                pos++;
+            return pos;
+        }
+
+        static constexpr size_t componentEnd(std::string_view s, size_t pos)
+        {
+            while(pos < s.size() && !isSeparator(s[pos]))
+                pos++;
+            return pos;
+        }
+
+        static constexpr bool isAbsolute(std::string_view s)
+        {
+            return (!s.empty() && isSeparator(s[0]))
+                || (s.size() >= 3 && s[1] == ':' && isSeparator(s[2]));
+        }
+    };
+
+    // The data part of a description: either a ready string
+    // or a formatter with its arguments that is called only when the description is read.
+    struct ErrorData
+    {
+        using Formatter = QString (*)(const QString& str, qint64 num);
+
+        QString str;
+        qint64 num {};
+        Formatter formatter {};
+
+        ErrorData() = default;
+        inline ErrorData(const QString& str) : str(str){}
+        inline ErrorData(const char* str) : str(QString::fromUtf8(str)){}
+        inline ErrorData(Formatter formatter, const QString& str, qint64 num) : str(str), num(num), formatter(formatter){}
+
+        inline QString toString() const {return formatter ? formatter(str, num) : str;}
+    };
+
+    // Converts to QString on demand, e.g. "Cannot read: pos: 100".
+    // The text is not stored, every read formats it again.
+    class Description
+    {
+    public:
+        Description() = default;
+        inline Description(const QString& text) : data(text){}
+        inline Description(QString (*codeFormatter)(int), int errorVal, const ErrorData& data):
+            codeFormatter(codeFormatter),
+            errorVal(errorVal),
+            data(data)
+        {
+        }
+
+        QString toString() const;
+        inline operator QString() const {return toString();}
+        inline bool isEmpty() const {return toString().isEmpty();}
+
+    protected:
+        friend class ErrorManager;
+
+        QString (*codeFormatter)(int) {};
+        int errorVal {};
+        ErrorData data;
+    };
+
     struct ErrorStruct
     {
         bool isException {};
         const void* sender {};
         const std::type_info* senderTypeInfo {};
+        const SourceLocation* location {};
         const char* sourceFile {};
         const char* funcSig {};
         int sourceLine {};
         int errorVal {};
         const std::type_info* codeTypeInfo {};
-        const char* errorScope {};
-        const char* errorName {};
-        QString description;
+        QMetaEnum (*codeMetaEnum)() {};
+        Description description;
+        quint64 suppressedCount {}; // the number of the same errors not emitted since the last report, see setRateLimit()
 
         ErrorStruct() = default;
         inline ErrorStruct(const ErrorStruct& obj) = default;
@@ -77,30 +239,29 @@ public:
                 bool isException,
                 const void* sender,
                 const std::type_info& senderTypeInfo,
-                const char* sourceFile,
-                const char* funcSig,
-                int sourceLine,
-                const QString& description,
+                const SourceLocation& location,
+                const Description& description,
                 int errorVal,
                 const std::type_info& codeTypeInfo,
-                const char* errorScope,
-                const char* errorName):
+                QMetaEnum (*codeMetaEnum)()):
             isException(isException),
             sender(sender),
             senderTypeInfo(&senderTypeInfo),
-            sourceFile(sourceFile),
-            funcSig(funcSig),
-            sourceLine(sourceLine),
+            location(&location),
+            sourceFile(location.file),
+            funcSig(location.funcSig),
+            sourceLine(location.line),
             errorVal(errorVal),
             codeTypeInfo(&codeTypeInfo),
-            errorScope(errorScope),
-            errorName(errorName),
+            codeMetaEnum(codeMetaEnum),
             description(description)
         {
         }
 
         virtual ~ErrorStruct() = default;
         QString logLine() const;
+        const char* errorScope() const;
+        const char* errorName() const;
 
         template<typename T>
         bool codeIs(T errorCode) const
@@ -125,16 +286,13 @@ public:
         {
             return std::type_index(typeid(T*)) == std::type_index(*senderTypeInfo);
         }
-
-    protected:
-        QString getDescription() const;
     };
 
     class Exception : public std::runtime_error
     {
     public:
         explicit inline Exception(const ErrorManager::ErrorStruct &err)
-            : std::runtime_error(err.description.toUtf8().constData())
+            : std::runtime_error(err.description.toString().toUtf8().constData())
             , err_(err)
         {
         }
@@ -146,18 +304,47 @@ public:
         ErrorStruct err_;
     };
 
+    // an error from history()
+    struct HistoryEntry
+    {
+        quintptr threadId {};
+        QString threadName;
+        qint64 msecsSinceEpoch {};
+        ErrorStruct error;
+    };
+
     inline static const ErrorStruct& lastError() {return lastErrorStruct;}
+
+    // Every thread keeps its last historySize errors in its own ring.
+    // Recording takes no locks and allocates only for the first error of a thread.
+    // The data part of a description is truncated to historyDataLength characters.
+    static const int historySize = 64;
+    static const int historyDataLength = 96;
+    // the recent errors of all running threads, the oldest first
+    static QVector<HistoryEntry> history();
+
+    // the errors of one source line and error code, see errorCounters()
+    struct ErrorCounter
+    {
+        ErrorStruct error; // without the sender and the data part of the description
+        quint64 count {};
+        quint64 suppressedCount {};
+    };
+
+    // Only the first "burst" errors of the same source line and code within windowMsecs are emitted with onError().
+    // The rest are counted and reported as "N more occurrences" with the next emitted error,
+    // or by a timer when the window has passed (it only runs while there is something to report).
+    // lastError(), errno, history() and exceptions are not affected.
+    // The default is 10 per second; burst <= 0 disables the limit.
+    static void setRateLimit(int burst, int windowMsecs);
+    // the counters are kept in a lock-free table, the errors that don't fit in it are not limited
+    static const int errorCounterTableSize = 1024;
+    static QVector<ErrorCounter> errorCounters();
+
     static const int errnoMask = 0x0f000000;
     inline static ErrorManager *instance(){return errMan;}
 
-    inline void setError(const ErrorStruct& err)
-    {
-        lastErrorStruct = err;
-        errno = err.errorVal | errnoMask;
-        emit onError(err);
-        if(err.isException)
-            throw Exception(err);
-    }
+    void setError(const ErrorStruct& err);
 
     template<typename Code>
     static int getErrorVal(Code errorCode)
@@ -165,32 +352,32 @@ public:
         return static_cast<std::underlying_type_t<Code>>(errorCode);
     }
 
+    template<typename Code>
+    static QMetaEnum metaEnum()
+    {
+        return QMetaEnum::fromType<Code>();
+    }
+
     template<typename Code>
     inline static void setError(
             bool isException,
             const void* sender,
             const std::type_info& senderTypeInfo,
-            const char* sourceFile,
-            const char* funcSig,
-            int sourceLine,
+            const SourceLocation& location,
             Code errorCode,
-            const QString& errorString,
-            const QString& dataString = QString())
+            QString (*codeFormatter)(int),
+            const ErrorData& data = ErrorData())
     {
         int errorVal = getErrorVal(errorCode);
-        QMetaEnum meta = QMetaEnum::fromType<Code>();
         ErrorStruct err(
                     isException,
                     sender,
                     senderTypeInfo,
-                    sourceFile,
-                    funcSig,
-                    sourceLine,
-                    getDescription(errorString, dataString),
+                    location,
+                    Description(codeFormatter, errorVal, data),
                     errorVal,
                     typeid(errorCode),
-                    meta.scope(),
-                    meta.valueToKey(errorVal));
+                    &metaEnum<Code>);
         ErrorManager::instance()->setError(err);
     }
 
@@ -220,6 +407,12 @@ protected:
     ErrorManager();
     static ErrorManager* errMan;
     static thread_local ErrorStruct lastErrorStruct;
+    int reportTimerId;
+
+    static void addToHistory(const ErrorStruct& err);
+    void timerEvent(QTimerEvent* event) override;
+    Q_INVOKABLE void startReportTimer();
+    bool reportSuppressed();
 
 signals:
     void onError(const ErrorManager::ErrorStruct &err);
@@ -0,0 +1,659 @@
+/****************************************************************************}
+{ fasthash.cpp - fast content hashing                                        }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#include "fasthash.h"
+#include "qiodevicehelper.h"
+#include <QtConcurrent>
+
+#if defined(Q_CC_GNU) && (defined(Q_PROCESSOR_X86_64) || defined(Q_PROCESSOR_X86_32))
+    #include <nmmintrin.h>
+    #define FASTHASH_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+#endif
+
+static const quint32 blake3IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+static const int blake3BlockLen = 64;
+static const int blake3ChunkLen = 1024;
+
+static const quint32 chunkStart = 1;
+static const quint32 chunkEnd = 2;
+static const quint32 parentNode = 4;
+static const quint32 rootNode = 8;
+static const quint32 keyedHash = 16;
+
+static const qint64 minParallelSize = 1024 * 1024;
+static const qint64 minSubtreeSize = 256 * 1024;
+static const qint64 readBlockSize = 256 * 1024;
+
+static inline quint32 rotr(quint32 w, int c)
+{
+    return (w >> c) | (w << (32 - c));
+}
+
+static inline void g(quint32* s, int a, int b, int c, int d, quint32 mx, quint32 my)
+{
+    s[a] = s[a] + s[b] + mx;
+    s[d] = rotr(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = rotr(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + my;
+    s[d] = rotr(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = rotr(s[b] ^ s[c], 7);
+}
+
+static void compress(const quint32* cv, const quint32* blockWords, quint64 counter, quint32 blockLen, quint32 flags, quint32* out)
+{
+    static const int schedule[7][16] = {
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+        {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+        {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+        {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+        {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+        {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+        {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+    };
+
+    quint32 s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        blake3IV[0], blake3IV[1], blake3IV[2], blake3IV[3],
+        static_cast<quint32>(counter), static_cast<quint32>(counter >> 32), blockLen, flags
+    };
+    for(const int* m : schedule)
+    {
+        g(s, 0, 4, 8, 12, blockWords[m[0]], blockWords[m[1]]);
+        g(s, 1, 5, 9, 13, blockWords[m[2]], blockWords[m[3]]);
+        g(s, 2, 6, 10, 14, blockWords[m[4]], blockWords[m[5]]);
+        g(s, 3, 7, 11, 15, blockWords[m[6]], blockWords[m[7]]);
+        g(s, 0, 5, 10, 15, blockWords[m[8]], blockWords[m[9]]);
+        g(s, 1, 6, 11, 12, blockWords[m[10]], blockWords[m[11]]);
+        g(s, 2, 7, 8, 13, blockWords[m[12]], blockWords[m[13]]);
+        g(s, 3, 4, 9, 14, blockWords[m[14]], blockWords[m[15]]);
+    }
+    for(int a=0; a<8; a++)
+    {
+        out[a] = s[a] ^ s[a + 8];
+        out[a + 8] = s[a + 8] ^ cv[a];
+    }
+}
+
+static inline void loadBlock(const uchar* p, int len, quint32* blockWords)
+{
+    if(len == blake3BlockLen)
+    {
+        for(int a=0; a<16; a++)
+            blockWords[a] = qFromLittleEndian<quint32>(p + a * 4);
+        return;
+    }
+    uchar padded[blake3BlockLen] = {};
+    memcpy(padded, p, static_cast<size_t>(len));
+    loadBlock(padded, blake3BlockLen, blockWords);
+}
+
+namespace {
+    // the last compression of a node, postponed until it's known whether the node is the root
+    struct Output
+    {
+        quint32 cv[8];
+        quint32 blockWords[16];
+        quint64 counter;
+        quint32 blockLen;
+        quint32 flags;
+
+        void chainingValue(quint32* out) const
+        {
+            quint32 res[16];
+            compress(cv, blockWords, counter, blockLen, flags, res);
+            memcpy(out, res, 32);
+        }
+
+        QByteArray rootHash() const
+        {
+            quint32 res[16];
+            compress(cv, blockWords, 0, blockLen, flags | rootNode, res);
+            QByteArray hash(FastHash::blake3Size, Qt::Uninitialized);
+            for(int a=0; a<8; a++)
+                qToLittleEndian<quint32>(res[a], hash.data() + a * 4);
+            return hash;
+        }
+    };
+
+    struct Subtree
+    {
+        const uchar* data;
+        qint64 len;
+        quint64 chunkCounter;
+        quint32 cv[8];
+    };
+}
+
+static Output chunkOutput(const quint32* key, quint32 flags, const uchar* data, qint64 len, quint64 chunkCounter)
+{
+    Output o;
+    memcpy(o.cv, key, sizeof(o.cv));
+    quint32 blockFlags = flags | chunkStart;
+    while(len > blake3BlockLen)
+    {
+        quint32 blockWords[16];
+        quint32 res[16];
+        loadBlock(data, blake3BlockLen, blockWords);
+        compress(o.cv, blockWords, chunkCounter, blake3BlockLen, blockFlags, res);
+        memcpy(o.cv, res, sizeof(o.cv));
+        blockFlags = flags;
+        data += blake3BlockLen;
+        len -= blake3BlockLen;
+    }
+    loadBlock(data, static_cast<int>(len), o.blockWords);
+    o.counter = chunkCounter;
+    o.blockLen = static_cast<quint32>(len);
+    o.flags = blockFlags | chunkEnd;
+    return o;
+}
+
+static Output parentOutput(const quint32* key, quint32 flags, const quint32* left, const quint32* right)
+{
+    Output o;
+    memcpy(o.cv, key, sizeof(o.cv));
+    memcpy(o.blockWords, left, 32);
+    memcpy(o.blockWords + 8, right, 32);
+    o.counter = 0;
+    o.blockLen = blake3BlockLen;
+    o.flags = flags | parentNode;
+    return o;
+}
+
+// the tree is left-balanced: the left subtree holds the largest power of two chunks
+// that leaves at least one byte for the right one
+static inline qint64 leftSubtreeLen(qint64 len)
+{
+    quint64 fullChunks = static_cast<quint64>((len - 1) / blake3ChunkLen);
+    return static_cast<qint64>(quint64(1) << (63 - qCountLeadingZeroBits(fullChunks))) * blake3ChunkLen;
+}
+
+static Output subtreeOutput(const quint32* key, quint32 flags, const uchar* data, qint64 len, quint64 chunkCounter);
+
+static void subtreeCv(const quint32* key, quint32 flags, const uchar* data, qint64 len, quint64 chunkCounter, quint32* out)
+{
+    subtreeOutput(key, flags, data, len, chunkCounter).chainingValue(out);
+}
+
+static Output subtreeOutput(const quint32* key, quint32 flags, const uchar* data, qint64 len, quint64 chunkCounter)
+{
+    if(len <= blake3ChunkLen)
+        return chunkOutput(key, flags, data, len, chunkCounter);
+    qint64 leftLen = leftSubtreeLen(len);
+    quint32 left[8];
+    quint32 right[8];
+    subtreeCv(key, flags, data, leftLen, chunkCounter, left);
+    subtreeCv(key, flags, data + leftLen, len - leftLen, chunkCounter + static_cast<quint64>(leftLen / blake3ChunkLen), right);
+    return parentOutput(key, flags, left, right);
+}
+
+static void collectSubtrees(const uchar* data, qint64 len, quint64 chunkCounter, qint64 maxLen, QVector<Subtree>& subtrees)
+{
+    if(len <= maxLen)
+    {
+        subtrees.append({data, len, chunkCounter, {}});
+        return;
+    }
+    qint64 leftLen = leftSubtreeLen(len);
+    collectSubtrees(data, leftLen, chunkCounter, maxLen, subtrees);
+    collectSubtrees(data + leftLen, len - leftLen, chunkCounter + static_cast<quint64>(leftLen / blake3ChunkLen), maxLen, subtrees);
+}
+
+// walks the same split as collectSubtrees, taking the precomputed values from "subtrees"
+static void joinSubtrees(const quint32* key, quint32 flags, qint64 len, qint64 maxLen, const Subtree*& subtree, quint32* out)
+{
+    if(len <= maxLen)
+    {
+        memcpy(out, subtree->cv, 32);
+        subtree++;
+        return;
+    }
+    qint64 leftLen = leftSubtreeLen(len);
+    quint32 left[8];
+    quint32 right[8];
+    joinSubtrees(key, flags, leftLen, maxLen, subtree, left);
+    joinSubtrees(key, flags, len - leftLen, maxLen, subtree, right);
+    parentOutput(key, flags, left, right).chainingValue(out);
+}
+
+static Output treeOutput(const quint32* key, quint32 flags, const uchar* data, qint64 len, bool parallel)
+{
+    if(!parallel || len < minParallelSize)
+        return subtreeOutput(key, flags, data, len, 0);
+
+    qint64 maxLen = qMax(minSubtreeSize, len / (QThread::idealThreadCount() * 4));
+    QVector<Subtree> subtrees;
+    qint64 leftLen = leftSubtreeLen(len);
+    collectSubtrees(data, leftLen, 0, maxLen, subtrees);
+    int nLeft = subtrees.size();
+    collectSubtrees(data + leftLen, len - leftLen, static_cast<quint64>(leftLen / blake3ChunkLen), maxLen, subtrees);
+
+    QtConcurrent::blockingMap(subtrees, [key, flags](Subtree& s){
+        subtreeCv(key, flags, s.data, s.len, s.chunkCounter, s.cv);
+    });
+
+    quint32 left[8];
+    quint32 right[8];
+    const Subtree* subtree = subtrees.constData();
+    joinSubtrees(key, flags, leftLen, maxLen, subtree, left);
+    Q_ASSERT(subtree == subtrees.constData() + nLeft);
+    Q_UNUSED(nLeft);
+    joinSubtrees(key, flags, len - leftLen, maxLen, subtree, right);
+    return parentOutput(key, flags, left, right);
+}
+
+//
+// FastHash::Blake3
+//
+
+FastHash::Blake3::Blake3()
+{
+    memcpy(key, blake3IV, sizeof(key));
+    flags = 0;
+    reset();
+}
+
+FastHash::Blake3::Blake3(const char *key)
+{
+    for(int a=0; a<8; a++)
+        this->key[a] = qFromLittleEndian<quint32>(key + a * 4);
+    flags = keyedHash;
+    reset();
+}
+
+void FastHash::Blake3::reset()
+{
+    memcpy(chunkCv, key, sizeof(chunkCv));
+    blockLen = 0;
+    blocksCompressed = 0;
+    chunkCounter = 0;
+    cvStackLen = 0;
+}
+
+void FastHash::Blake3::addData(const char *data, qint64 size)
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data);
+    while(size > 0)
+    {
+        // whole chunks that are known not to be the last one skip the block buffer
+        if(!blockLen && !blocksCompressed)
+        {
+            while(size > blake3ChunkLen)
+            {
+                quint32 cv[8];
+                chunkOutput(key, flags, p, blake3ChunkLen, chunkCounter).chainingValue(cv);
+                pushChunkCv(cv);
+                p += blake3ChunkLen;
+                size -= blake3ChunkLen;
+            }
+        }
+
+        if(blockLen == blake3BlockLen)
+        {
+            if(blocksCompressed == blake3ChunkLen / blake3BlockLen - 1)
+            {
+                // the chunk is complete and more data follows
+                Output o;
+                memcpy(o.cv, chunkCv, sizeof(o.cv));
+                loadBlock(block, blake3BlockLen, o.blockWords);
+                o.counter = chunkCounter;
+                o.blockLen = blake3BlockLen;
+                o.flags = flags | chunkEnd;
+                quint32 cv[8];
+                o.chainingValue(cv);
+                pushChunkCv(cv);
+                memcpy(chunkCv, key, sizeof(chunkCv));
+                blocksCompressed = 0;
+                blockLen = 0;
+                continue;
+            }
+            quint32 blockWords[16];
+            quint32 res[16];
+            loadBlock(block, blake3BlockLen, blockWords);
+            compress(chunkCv, blockWords, chunkCounter, blake3BlockLen, flags | (blocksCompressed ? 0 : chunkStart), res);
+            memcpy(chunkCv, res, sizeof(chunkCv));
+            blocksCompressed++;
+            blockLen = 0;
+        }
+
+        int n = static_cast<int>(qMin<qint64>(blake3BlockLen - blockLen, size));
+        memcpy(block + blockLen, p, static_cast<size_t>(n));
+        blockLen += n;
+        p += n;
+        size -= n;
+    }
+}
+
+bool FastHash::Blake3::addData(QIODevice *device)
+{
+    QByteArray buf(static_cast<int>(readBlockSize), Qt::Uninitialized);
+    forever
+    {
+        qint64 n = device->read(buf.data(), buf.size());
+        if(n > 0)
+        {
+            addData(buf.constData(), n);
+            continue;
+        }
+        // atEnd() of sockets and processes is also true when nothing has arrived yet,
+        // so only a failed wait (closed or finished device) is the end
+        if(n == 0 && device->isSequential() && device->waitForReadyRead(-1))
+            continue;
+        return n == 0 || device->atEnd();
+    }
+}
+
+QByteArray FastHash::Blake3::result() const
+{
+    Output o;
+    memcpy(o.cv, chunkCv, sizeof(o.cv));
+    loadBlock(block, blockLen, o.blockWords);
+    o.counter = chunkCounter;
+    o.blockLen = static_cast<quint32>(blockLen);
+    o.flags = flags | (blocksCompressed ? 0 : chunkStart) | chunkEnd;
+    for(int a=cvStackLen-1; a>=0; a--)
+    {
+        quint32 cv[8];
+        o.chainingValue(cv);
+        o = parentOutput(key, flags, cvStack[a], cv);
+    }
+    return o.rootHash();
+}
+
+void FastHash::Blake3::pushChunkCv(quint32 *cv)
+{
+    // merge every completed subtree: one merge per trailing zero bit of the chunk count
+    chunkCounter++;
+    for(quint64 total = chunkCounter; !(total & 1); total >>= 1)
+        parentOutput(key, flags, cvStack[--cvStackLen], cv).chainingValue(cv);
+    memcpy(cvStack[cvStackLen++], cv, 32);
+}
+
+//
+// FastHash::Xxh64
+//
+
+static const quint64 xxhPrime1 = 0x9E3779B185EBCA87ULL;
+static const quint64 xxhPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const quint64 xxhPrime3 = 0x165667B19E3779F9ULL;
+static const quint64 xxhPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const quint64 xxhPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline quint64 rotl64(quint64 w, int c)
+{
+    return (w << c) | (w >> (64 - c));
+}
+
+static inline quint64 xxhRound(quint64 acc, quint64 input)
+{
+    return rotl64(acc + input * xxhPrime2, 31) * xxhPrime1;
+}
+
+static inline quint64 xxhMerge(quint64 h, quint64 acc)
+{
+    return (h ^ xxhRound(0, acc)) * xxhPrime1 + xxhPrime4;
+}
+
+static inline void xxhStripe(quint64* acc, const uchar* p)
+{
+    for(int a=0; a<4; a++)
+        acc[a] = xxhRound(acc[a], qFromLittleEndian<quint64>(p + a * 8));
+}
+
+FastHash::Xxh64::Xxh64(quint64 seed)
+    :seed(seed)
+{
+    reset();
+}
+
+void FastHash::Xxh64::reset()
+{
+    acc[0] = seed + xxhPrime1 + xxhPrime2;
+    acc[1] = seed + xxhPrime2;
+    acc[2] = seed;
+    acc[3] = seed - xxhPrime1;
+    bufLen = 0;
+    total = 0;
+}
+
+void FastHash::Xxh64::addData(const char *data, qint64 size)
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data);
+    total += static_cast<quint64>(size);
+    if(bufLen)
+    {
+        int n = static_cast<int>(qMin<qint64>(32 - bufLen, size));
+        memcpy(buf + bufLen, p, static_cast<size_t>(n));
+        bufLen += n;
+        p += n;
+        size -= n;
+        if(bufLen < 32)
+            return;
+        xxhStripe(acc, buf);
+        bufLen = 0;
+    }
+    for(; size >= 32; p += 32, size -= 32)
+        xxhStripe(acc, p);
+    memcpy(buf, p, static_cast<size_t>(size));
+    bufLen = static_cast<int>(size);
+}
+
+quint64 FastHash::Xxh64::result() const
+{
+    quint64 h;
+    if(total >= 32)
+    {
+        h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+        for(quint64 v : acc)
+            h = xxhMerge(h, v);
+    }
+    else
+    {
+        h = seed + xxhPrime5;
+    }
+    h += total;
+
+    const uchar* p = buf;
+    int len = bufLen;
+    for(; len >= 8; p += 8, len -= 8)
+        h = rotl64(h ^ xxhRound(0, qFromLittleEndian<quint64>(p)), 27) * xxhPrime1 + xxhPrime4;
+    if(len >= 4)
+    {
+        h = rotl64(h ^ (qFromLittleEndian<quint32>(p) * xxhPrime1), 23) * xxhPrime2 + xxhPrime3;
+        p += 4;
+        len -= 4;
+    }
+    for(; len; p++, len--)
+        h = rotl64(h ^ (*p * xxhPrime5), 11) * xxhPrime1;
+
+    h ^= h >> 33;
+    h *= xxhPrime2;
+    h ^= h >> 29;
+    h *= xxhPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+//
+// CRC32C
+//
+
+namespace {
+    // slicing-by-8 tables for the reflected Castagnoli polynomial
+    struct Crc32cTable
+    {
+        quint32 t[8][256];
+
+        Crc32cTable()
+        {
+            for(quint32 a=0; a<256; a++)
+            {
+                quint32 c = a;
+                for(int b=0; b<8; b++)
+                    c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+                t[0][a] = c;
+            }
+            for(int a=0; a<256; a++)
+                for(int b=1; b<8; b++)
+                    t[b][a] = (t[b - 1][a] >> 8) ^ t[0][t[b - 1][a] & 0xFF];
+        }
+    };
+}
+
+static quint32 crc32cSoftware(const uchar* p, qint64 size, quint32 c)
+{
+    static const Crc32cTable table;
+    const auto& t = table.t;
+    for(; size >= 8; p += 8, size -= 8)
+    {
+        quint32 lo = qFromLittleEndian<quint32>(p) ^ c;
+        quint32 hi = qFromLittleEndian<quint32>(p + 4);
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+          ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    for(; size; p++, size--)
+        c = (c >> 8) ^ t[0][(c ^ *p) & 0xFF];
+    return c;
+}
+
+#ifdef FASTHASH_SSE42
+__attribute__((target("sse4.2")))
+static quint32 crc32cHardware(const uchar* p, qint64 size, quint32 c)
+{
+#ifdef Q_PROCESSOR_X86_64
+    quint64 c64 = c;
+    for(; size >= 8; p += 8, size -= 8)
+        c64 = _mm_crc32_u64(c64, qFromLittleEndian<quint64>(p));
+    c = static_cast<quint32>(c64);
+#endif
+    for(; size >= 4; p += 4, size -= 4)
+        c = _mm_crc32_u32(c, qFromLittleEndian<quint32>(p));
+    for(; size; p++, size--)
+        c = _mm_crc32_u8(c, *p);
+    return c;
+}
+
+static bool hasSse42()
+{
+    static const bool res = __builtin_cpu_supports("sse4.2");
+    return res;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static quint32 crc32cHardware(const uchar* p, qint64 size, quint32 c)
+{
+    for(; size >= 8; p += 8, size -= 8)
+        c = __crc32cd(c, qFromLittleEndian<quint64>(p));
+    for(; size; p++, size--)
+        c = __crc32cb(c, *p);
+    return c;
+}
+#endif
+
+//
+// FastHash
+//
+
+QByteArray FastHash::blake3(const char *data, qint64 size, bool parallel)
+{
+    return treeOutput(blake3IV, 0, reinterpret_cast<const uchar*>(data), size, parallel).rootHash();
+}
+
+QByteArray FastHash::blake3Keyed(const char *key, const char *data, qint64 size, bool parallel)
+{
+    quint32 keyWords[8];
+    for(int a=0; a<8; a++)
+        keyWords[a] = qFromLittleEndian<quint32>(key + a * 4);
+    return treeOutput(keyWords, keyedHash, reinterpret_cast<const uchar*>(data), size, parallel).rootHash();
+}
+
+quint32 FastHash::crc32c(const char *data, qint64 size, quint32 crc)
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data);
+#if defined(FASTHASH_SSE42)
+    if(hasSse42())
+        return ~crc32cHardware(p, size, ~crc);
+#elif defined(__ARM_FEATURE_CRC32)
+    return ~crc32cHardware(p, size, ~crc);
+#endif
+    return ~crc32cSoftware(p, size, ~crc);
+}
+
+quint64 FastHash::xxh64(const char *data, qint64 size, quint64 seed)
+{
+    Xxh64 h(seed);
+    h.addData(data, size);
+    return h.result();
+}
+
+QByteArray FastHash::hashFile(const QString &filename)
+{
+    QFileEx file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        file.close(false);
+        SETERROR_S(FastHash, Err::openFile, filename);
+        return QByteArray();
+    }
+
+    QByteArray hash;
+    qint64 size = file.isSequential() ? 0 : file.size();
+    uchar* map = size ? file.map(0, size) : nullptr;
+    if(map)
+    {
+        file.advise(QFileEx::Advice::willNeed);
+        hash = blake3(reinterpret_cast<const char*>(map), size);
+        file.unmap(map);
+    }
+    else
+    {
+        file.advise(QFileEx::Advice::sequential);
+        Blake3 hasher;
+        if(hasher.addData(&file))
+            hash = hasher.result();
+        else
+            SETERROR_S(FastHash, Err::readFile, filename);
+    }
+    // QFileEx must not touch "<filename>~" here
+    file.close(false);
+    return hash;
+}
+
+QByteArray FastHash::hashDevice(QIODevice *device)
+{
+    Blake3 hasher;
+    if(!hasher.addData(device))
+    {
+        SETERROR_S(FastHash, Err::readFile);
+        return QByteArray();
+    }
+    return hasher.result();
+}
+
+QString FastHash::errorCodeToString(Err errorCode)
+{
+    switch(errorCode)
+    {
+        case Err::openFile: return QStringLiteral("Cannot open the file");
+        case Err::readFile: return QStringLiteral("Cannot read the data");
+    }
+    return QString();
+}
@@ -0,0 +1,100 @@
+/****************************************************************************}
+{ fasthash.h - fast content hashing                                          }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#pragma once
+
+#include "errormanager.h"
+
+// BLAKE3 (32-byte output, optionally keyed).
+// Large inputs are split into subtrees that are hashed in parallel;
+// the result is the same as with the streaming FastHash::Blake3.
+//
+// Also the non-cryptographic checksums CRC32C (SSE4.2/ARMv8 CRC instructions when available) and XXH64.
+class FastHash
+{
+    Q_GADGET
+
+public:
+    enum class Err {
+        openFile = 1,
+        readFile
+    };
+    Q_ENUM(Err)
+
+    static const int blake3Size = 32;
+    static const int blake3KeySize = 32;
+
+    // streaming mode for pipes, sockets and data that arrives in pieces
+    class Blake3
+    {
+    public:
+        Blake3();
+        // keyed mode, the key is blake3KeySize bytes
+        explicit Blake3(const char* key);
+        // keeps the key
+        void reset();
+        void addData(const char* data, qint64 size);
+        inline void addData(const QByteArray& data) {addData(data.constData(), data.size());}
+        // reads the device until the end
+        bool addData(QIODevice* device);
+        QByteArray result() const;
+
+    protected:
+        quint32 key[8];
+        quint32 flags;
+        quint32 chunkCv[8];
+        uchar block[64];
+        int blockLen;
+        int blocksCompressed;
+        quint64 chunkCounter;
+        quint32 cvStack[54][8];
+        int cvStackLen;
+
+        void pushChunkCv(quint32* cv);
+    };
+
+    class Xxh64
+    {
+    public:
+        explicit Xxh64(quint64 seed = 0);
+        void reset();
+        void addData(const char* data, qint64 size);
+        inline void addData(const QByteArray& data) {addData(data.constData(), data.size());}
+        quint64 result() const;
+
+    protected:
+        quint64 seed;
+        quint64 acc[4];
+        uchar buf[32];
+        int bufLen;
+        quint64 total;
+    };
+
+    static QByteArray blake3(const char* data, qint64 size, bool parallel = true);
+    static inline QByteArray blake3(const QByteArray& data) {return blake3(data.constData(), data.size());}
+    static QByteArray blake3Keyed(const char* key, const char* data, qint64 size, bool parallel = true);
+
+    // pass the previous result as "crc" to continue the checksum
+    static quint32 crc32c(const char* data, qint64 size, quint32 crc = 0);
+    static quint64 xxh64(const char* data, qint64 size, quint64 seed = 0);
+
+    // maps regular files and hashes them in parallel,
+    // everything else (or a file that can't be mapped) is read sequentially
+    static QByteArray hashFile(const QString& filename);
+    static QByteArray hashDevice(QIODevice* device);
+
+    static QString errorCodeToString(Err errorCode);
+};
@@ -0,0 +1,770 @@
+/****************************************************************************}
+{ iopipeline.cpp - multi-threaded zero-copy stream processing                }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#include "iopipeline.h"
+#include <climits>
+#include <memory>
+#include <zlib.h>
+
+namespace {
+    class PipelineThread : public QThread
+    {
+    public:
+        explicit PipelineThread(const std::function<void()>& func) : func(func){}
+    protected:
+        void run() override {func();}
+        std::function<void()> func;
+    };
+
+    class QueueOutput : public IOPipelineOutput
+    {
+    public:
+        QueueOutput(QIODeviceChunkPool* pool, IOPipelineQueue* queue) : IOPipelineOutput(pool), queue(queue){}
+        bool push(IOPipelineBuffer&& buf) override {return queue->push(std::move(buf));}
+    protected:
+        IOPipelineQueue* queue;
+    };
+
+    class ChainOutput : public IOPipelineOutput
+    {
+    public:
+        ChainOutput(QIODeviceChunkPool* pool, IOPipelineStage* next, IOPipelineOutput* nextOut)
+            : IOPipelineOutput(pool), next(next), nextOut(nextOut){}
+        bool push(IOPipelineBuffer&& buf) override
+        {
+            IOPipelineBuffer b(std::move(buf));
+            return next->process(b, *nextOut);
+        }
+    protected:
+        IOPipelineStage* next;
+        IOPipelineOutput* nextOut;
+    };
+}
+
+//
+// IOPipelineBuffer
+//
+
+IOPipelineBuffer::IOPipelineBuffer(QIODeviceChunkPool *pool)
+    :pool(pool)
+    ,ptr(pool->take())
+{
+}
+
+IOPipelineBuffer::IOPipelineBuffer(IOPipelineBuffer &&other) noexcept
+    :pool(other.pool)
+    ,ptr(other.ptr)
+    ,begin(other.begin)
+    ,sz(other.sz)
+{
+    other.ptr = nullptr;
+    other.begin = 0;
+    other.sz = 0;
+}
+
+IOPipelineBuffer &IOPipelineBuffer::operator=(IOPipelineBuffer &&other) noexcept
+{
+    if(this != &other)
+    {
+        release();
+        pool = other.pool;
+        ptr = other.ptr;
+        begin = other.begin;
+        sz = other.sz;
+        other.ptr = nullptr;
+        other.begin = 0;
+        other.sz = 0;
+    }
+    return *this;
+}
+
+IOPipelineBuffer::~IOPipelineBuffer()
+{
+    release();
+}
+
+void IOPipelineBuffer::release()
+{
+    if(ptr)
+        pool->give(ptr);
+    ptr = nullptr;
+    begin = 0;
+    sz = 0;
+}
+
+//
+// IOPipelineQueue
+//
+
+IOPipelineQueue::IOPipelineQueue(int capacity)
+    :cap(qMax(1, capacity))
+    ,closed(false)
+    ,aborted(false)
+{
+}
+
+bool IOPipelineQueue::push(IOPipelineBuffer &&buf)
+{
+    QMutexLocker locker(&mutex);
+    while(!aborted && static_cast<int>(items.size()) >= cap)
+        notFull.wait(&mutex);
+    if(aborted)
+        return false;
+    items.push_back(std::move(buf));
+    notEmpty.wakeOne();
+    locker.unlock();
+    if(notify)
+        notify();
+    return true;
+}
+
+bool IOPipelineQueue::tryPush(IOPipelineBuffer &buf)
+{
+    QMutexLocker locker(&mutex);
+    if(aborted || static_cast<int>(items.size()) >= cap)
+        return false;
+    items.push_back(std::move(buf));
+    notEmpty.wakeOne();
+    locker.unlock();
+    if(notify)
+        notify();
+    return true;
+}
+
+bool IOPipelineQueue::pop(IOPipelineBuffer &buf, int msecs)
+{
+    QMutexLocker locker(&mutex);
+    while(!aborted && !closed && items.empty())
+    {
+        if(!notEmpty.wait(&mutex, msecs < 0 ? ULONG_MAX : static_cast<unsigned long>(msecs)))
+            return false;
+    }
+    if(aborted || items.empty())
+        return false;
+    buf = std::move(items.front());
+    items.pop_front();
+    notFull.wakeOne();
+    return true;
+}
+
+void IOPipelineQueue::close()
+{
+    QMutexLocker locker(&mutex);
+    closed = true;
+    notEmpty.wakeAll();
+    locker.unlock();
+    if(notify)
+        notify();
+}
+
+void IOPipelineQueue::abort()
+{
+    QMutexLocker locker(&mutex);
+    aborted = true;
+    items.clear();
+    notEmpty.wakeAll();
+    notFull.wakeAll();
+}
+
+bool IOPipelineQueue::isFinished() const
+{
+    QMutexLocker locker(&mutex);
+    return aborted || (closed && items.empty());
+}
+
+bool IOPipelineQueue::isAborted() const
+{
+    QMutexLocker locker(&mutex);
+    return aborted;
+}
+
+bool IOPipelineQueue::hasData() const
+{
+    QMutexLocker locker(&mutex);
+    return !items.empty();
+}
+
+bool IOPipelineQueue::isFull() const
+{
+    QMutexLocker locker(&mutex);
+    return static_cast<int>(items.size()) >= cap;
+}
+
+//
+// stages
+//
+
+IOPipelineHashStage::IOPipelineHashStage(QCryptographicHash::Algorithm algorithm)
+    :hash(algorithm)
+{
+}
+
+bool IOPipelineHashStage::process(IOPipelineBuffer &in, IOPipelineOutput &out)
+{
+    hash.addData(in.constData(), in.size());
+    return out.push(std::move(in));
+}
+
+bool IOPipelineLineStage::process(IOPipelineBuffer &in, IOPipelineOutput &out)
+{
+    const char* d = in.constData();
+    int n = in.size();
+    int pos = 0;
+
+    // complete the line left from the previous buffer
+    while(!tail.isNull() && pos < n)
+    {
+        const char* nl = static_cast<const char*>(memchr(d + pos, '\n', static_cast<size_t>(n - pos)));
+        int len = nl ? static_cast<int>(nl - d) - pos + 1 : n - pos;
+        int c = qMin(len, tail.capacity() - tail.size());
+        memcpy(tail.data() + tail.size(), d + pos, static_cast<size_t>(c));
+        tail.setSize(tail.size() + c);
+        pos += c;
+        if((nl && c == len) || tail.size() == tail.capacity())
+            if(!out.push(std::move(tail)))
+                return false;
+    }
+    if(pos == n)
+        return true;
+    in.trimFront(pos);
+
+    // keep the incomplete last line for the next buffer
+    d = in.constData();
+    n = in.size();
+    int end = n;
+    while(end > 0 && d[end - 1] != '\n')
+        end--;
+    if(end == 0)
+    {
+        tail = std::move(in);
+        return true;
+    }
+    if(end < n)
+    {
+        tail = out.allocate();
+        memcpy(tail.data(), d + end, static_cast<size_t>(n - end));
+        tail.setSize(n - end);
+        in.setSize(end);
+    }
+    return out.push(std::move(in));
+}
+
+bool IOPipelineLineStage::finish(IOPipelineOutput &out)
+{
+    if(tail.isNull() || !tail.size())
+        return true;
+    return out.push(std::move(tail));
+}
+
+IOPipelineInflateStage::IOPipelineInflateStage()
+    :stream(new z_stream{})
+    ,streamEnd(false)
+{
+    // 15 + 32: zlib or gzip header, detected automatically
+    initialized = inflateInit2(static_cast<z_stream*>(stream), 15 + 32) == Z_OK;
+}
+
+IOPipelineInflateStage::~IOPipelineInflateStage()
+{
+    if(initialized)
+        inflateEnd(static_cast<z_stream*>(stream));
+    delete static_cast<z_stream*>(stream);
+}
+
+bool IOPipelineInflateStage::process(IOPipelineBuffer &in, IOPipelineOutput &out)
+{
+    if(!initialized)
+        return false;
+    if(streamEnd)
+        return true;
+    z_stream* s = static_cast<z_stream*>(stream);
+    s->next_in = reinterpret_cast<Bytef*>(in.data());
+    s->avail_in = static_cast<uInt>(in.size());
+    bool full;
+    do
+    {
+        IOPipelineBuffer o = out.allocate();
+        s->next_out = reinterpret_cast<Bytef*>(o.data());
+        s->avail_out = static_cast<uInt>(o.capacity());
+        int res = inflate(s, Z_NO_FLUSH);
+        if(res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+            return false;
+        o.setSize(o.capacity() - static_cast<int>(s->avail_out));
+        full = !s->avail_out;
+        if(o.size() && !out.push(std::move(o)))
+            return false;
+        if(res == Z_STREAM_END)
+        {
+            streamEnd = true;
+            break;
+        }
+        if(res == Z_BUF_ERROR)
+            break;
+    }
+    while(full || s->avail_in);
+    return true;
+}
+
+bool IOPipelineInflateStage::finish(IOPipelineOutput &out)
+{
+    Q_UNUSED(out);
+    return initialized && streamEnd;
+}
+
+//
+// IOPipelineSourceReader
+//
+
+// Reads the source in the source's thread and never blocks its event loop:
+// when the first queue is full, the data waits here and is retried a bit later.
+class IOPipelineSourceReader : public QObject
+{
+public:
+    IOPipelineSourceReader(QIODevice* source, IOPipelineQueue* queue, QIODeviceChunkPool* pool, const std::function<void()>& onError)
+        :source(source)
+        ,queue(queue)
+        ,pool(pool)
+        ,onError(onError)
+        ,retryTimer(new QTimer(this))
+        ,channelFinished(false)
+        ,sourceClosed(false)
+        ,detached(false)
+    {
+        retryTimer->setSingleShot(true);
+        retryTimer->setInterval(10);
+        connect(retryTimer, &QTimer::timeout, this, &IOPipelineSourceReader::readAvailable);
+        connect(source, &QIODevice::readyRead, this, &IOPipelineSourceReader::readAvailable);
+        connect(source, &QIODevice::readChannelFinished, this, [this](){
+            channelFinished = true;
+            readAvailable();
+        });
+        connect(source, &QIODevice::aboutToClose, this, &IOPipelineSourceReader::readBeforeClose);
+        moveToThread(source->thread());
+        QTimer::singleShot(0, this, &IOPipelineSourceReader::readAvailable);
+    }
+
+    // after this the reader doesn't touch the pipeline anymore
+    void detach()
+    {
+        QMutexLocker locker(&mutex);
+        detached = true;
+    }
+
+protected:
+    QIODevice* source;
+    IOPipelineQueue* queue;
+    QIODeviceChunkPool* pool;
+    std::function<void()> onError;
+    QTimer* retryTimer;
+    bool channelFinished;
+    // the source isn't touched anymore, it may even be deleted
+    bool sourceClosed;
+    QMutex mutex;
+    bool detached;
+    std::deque<IOPipelineBuffer> pending;
+
+    // false if something is still waiting for space in the queue
+    bool flushPending()
+    {
+        while(!pending.empty())
+        {
+            if(!queue->tryPush(pending.front()))
+                return false;
+            pending.pop_front();
+        }
+        return true;
+    }
+
+    // false on error
+    bool readChunk(bool& gotData)
+    {
+        gotData = false;
+        IOPipelineBuffer buf(pool);
+        qint64 n = source->read(buf.data(), buf.capacity());
+        if(n < 0)
+        {
+            if(source->isOpen() && !channelFinished)
+                onError();
+            return false;
+        }
+        if(!n)
+            return true;
+        gotData = true;
+        buf.setSize(static_cast<int>(n));
+        if(!queue->tryPush(buf))
+            pending.push_back(std::move(buf));
+        return true;
+    }
+
+    void readAvailable()
+    {
+        QMutexLocker locker(&mutex);
+        if(detached || queue->isFinished())
+            return;
+        if(!flushPending())
+        {
+            retryTimer->start();
+            return;
+        }
+        if(!sourceClosed)
+        {
+            while(source->bytesAvailable() > 0)
+            {
+                if(queue->isFull())
+                {
+                    retryTimer->start();
+                    return;
+                }
+                bool gotData;
+                if(!readChunk(gotData))
+                {
+                    pending.clear();
+                    queue->close();
+                    return;
+                }
+                if(!gotData)
+                    break;
+            }
+        }
+        if(sourceClosed || channelFinished || !source->isOpen())
+            queue->close();
+    }
+
+    // the device won't emit anything after it's closed, so everything left is read now;
+    // what doesn't fit into the queue is sent from here later
+    void readBeforeClose()
+    {
+        QMutexLocker locker(&mutex);
+        if(detached || queue->isFinished())
+            return;
+        retryTimer->stop();
+        sourceClosed = true;
+        bool gotData = true;
+        while(gotData && source->bytesAvailable() > 0)
+        {
+            if(!readChunk(gotData))
+                break;
+        }
+        if(flushPending())
+            queue->close();
+        else
+            retryTimer->start();
+    }
+};
+
+//
+// IOPipelineDevice
+//
+
+IOPipelineDevice::IOPipelineDevice(IOPipelineQueue *queue, QObject *parent)
+    :QIODeviceHelper<QIODevice>(parent)
+    ,queue(queue)
+    ,notifyPending(false)
+{
+    queue->setNotify([this](){postNotify();});
+    open(ReadOnly | Unbuffered);
+}
+
+qint64 IOPipelineDevice::bytesAvailable() const
+{
+    return current.size() + QIODeviceHelper<QIODevice>::bytesAvailable();
+}
+
+bool IOPipelineDevice::atEnd() const
+{
+    return !current.size() && queue->isFinished() && !QIODeviceHelper<QIODevice>::bytesAvailable();
+}
+
+bool IOPipelineDevice::waitForReadyRead(int msecs)
+{
+    if(current.size())
+        return true;
+    current.release();
+    return queue->pop(current, msecs);
+}
+
+IOPipelineBuffer IOPipelineDevice::takeBuffer()
+{
+    if(!current.size())
+    {
+        current.release();
+        queue->pop(current, 0);
+    }
+    return std::move(current);
+}
+
+QEvent::Type IOPipelineDevice::notifyEventType()
+{
+    static const QEvent::Type type = static_cast<QEvent::Type>(QEvent::registerEventType());
+    return type;
+}
+
+// called by the thread of the last stage; a burst of buffers results in a single readyRead()
+void IOPipelineDevice::postNotify()
+{
+    if(!notifyPending.exchange(true))
+        QCoreApplication::postEvent(this, new QEvent(notifyEventType()));
+}
+
+bool IOPipelineDevice::event(QEvent *e)
+{
+    if(e->type() != notifyEventType())
+        return QIODeviceHelper<QIODevice>::event(e);
+    notifyPending = false;
+    if(current.size() || queue->hasData())
+        emit readyRead();
+    if(queue->isFinished())
+        emit readChannelFinished();
+    return true;
+}
+
+qint64 IOPipelineDevice::readData(char *data, qint64 maxSize)
+{
+    qint64 done = 0;
+    while(done < maxSize)
+    {
+        if(!current.size())
+        {
+            current.release();
+            // only waitForReadyRead() blocks
+            if(!queue->pop(current, 0))
+                break;
+            continue;
+        }
+        int n = static_cast<int>(qMin<qint64>(maxSize - done, current.size()));
+        memcpy(data + done, current.constData(), static_cast<size_t>(n));
+        current.trimFront(n);
+        done += n;
+    }
+    if(!done && queue->isFinished())
+        return -1;
+    return done;
+}
+
+qint64 IOPipelineDevice::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+//
+// IOPipeline
+//
+
+IOPipeline::IOPipeline(QIODevice *source, QIODeviceChunkPool *pool, int queueCapacity)
+    :source(source)
+    ,pool(pool ? pool : QIODeviceChunkPool::instance())
+    ,queueCapacity(queueCapacity)
+    ,sourceReader(nullptr)
+    ,failed(false)
+    ,started(false)
+{
+}
+
+IOPipeline::~IOPipeline()
+{
+    abort();
+    if(sourceReader)
+    {
+        sourceReader->detach();
+        sourceReader->deleteLater();
+    }
+    wait();
+    qDeleteAll(threads);
+    dev.reset();
+    qDeleteAll(stages);
+}
+
+void IOPipeline::addStage(IOPipelineStage *stage, bool separateThread)
+{
+    Q_ASSERT(!started);
+    stages.append(stage);
+    if(separateThread || groups.isEmpty())
+        groups.append(Group());
+    groups.last().stages.append(stage);
+}
+
+bool IOPipeline::start()
+{
+    if(started)
+        return false;
+    started = true;
+
+    for(int a=0; a<=groups.size(); a++)
+        queues.emplace_back(queueCapacity);
+    dev.reset(new IOPipelineDevice(&queues.back()));
+
+    if(source)
+    {
+        if(hasThreadAffinity(source))
+            sourceReader = new IOPipelineSourceReader(source, &queues.front(), pool, [this](){sourceFailed();});
+        else
+            threads.append(new PipelineThread([this](){runSource();}));
+    }
+    for(int a=0; a<groups.size(); a++)
+        threads.append(new PipelineThread([this, a](){runGroup(a);}));
+    for(QThread* t : qAsConst(threads))
+        t->start();
+    return true;
+}
+
+void IOPipeline::abort()
+{
+    for(IOPipelineQueue& q : queues)
+        q.abort();
+}
+
+bool IOPipeline::wait()
+{
+    for(QThread* t : qAsConst(threads))
+        t->wait();
+    return !failed;
+}
+
+bool IOPipeline::feed(IOPipelineBuffer &&buf)
+{
+    if(queues.empty())
+        return false;
+    return queues.front().push(std::move(buf));
+}
+
+bool IOPipeline::feed(const char *data, qint64 size)
+{
+    while(size > 0)
+    {
+        IOPipelineBuffer buf = allocate();
+        int n = static_cast<int>(qMin<qint64>(size, buf.capacity()));
+        memcpy(buf.data(), data, static_cast<size_t>(n));
+        buf.setSize(n);
+        if(!feed(std::move(buf)))
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void IOPipeline::closeInput()
+{
+    if(!queues.empty())
+        queues.front().close();
+}
+
+QString IOPipeline::errorCodeToString(Err errorCode)
+{
+    switch(errorCode)
+    {
+        case Err::readSource: return QStringLiteral("Cannot read from the source device");
+        case Err::stageFailed: return QStringLiteral("Pipeline stage has failed");
+    }
+    return QString();
+}
+
+bool IOPipeline::hasThreadAffinity(QIODevice *dev)
+{
+    return qobject_cast<QProcess*>(dev)
+        || dev->inherits("QAbstractSocket")
+        || dev->inherits("QLocalSocket");
+}
+
+void IOPipeline::runSource()
+{
+    IOPipelineQueue& q = queues.front();
+    forever
+    {
+        IOPipelineBuffer buf = allocate();
+        qint64 n = source->read(buf.data(), buf.capacity());
+        if(n > 0)
+        {
+            buf.setSize(static_cast<int>(n));
+            if(!q.push(std::move(buf)))
+                return;
+            continue;
+        }
+        if(n < 0)
+        {
+            if(!source->isOpen() || source->atEnd())
+                break;
+            sourceFailed();
+            return;
+        }
+        // reads of files block until there's data, so nothing read is the end
+        if(!source->isSequential() || qobject_cast<QFileDevice*>(source))
+            break;
+        // other sequential devices may just have nothing yet; only a closed one is at the end
+        if(q.isAborted())
+            return;
+        if(source->waitForReadyRead(100))
+            continue;
+        if(!source->isOpen())
+            break;
+        QThread::msleep(10);
+    }
+    q.close();
+}
+
+void IOPipeline::sourceFailed()
+{
+    SETERROR(Err::readSource);
+    fail();
+}
+
+void IOPipeline::runGroup(int groupIndex)
+{
+    IOPipelineQueue& in = queues[static_cast<size_t>(groupIndex)];
+    IOPipelineQueue& out = queues[static_cast<size_t>(groupIndex) + 1];
+    const QVector<IOPipelineStage*>& groupStages = groups.at(groupIndex).stages;
+
+    // outputs[i] leads from stage i to stage i+1 or, for the last stage, to the next queue
+    QueueOutput queueOutput(pool, &out);
+    std::vector<std::unique_ptr<ChainOutput>> chain;
+    QVector<IOPipelineOutput*> outputs(groupStages.size());
+    outputs.last() = &queueOutput;
+    for(int a=groupStages.size()-2; a>=0; a--)
+    {
+        chain.emplace_back(new ChainOutput(pool, groupStages.at(a + 1), outputs.at(a + 1)));
+        outputs[a] = chain.back().get();
+    }
+
+    bool ok = true;
+    IOPipelineBuffer buf;
+    while(ok && in.pop(buf))
+    {
+        ok = groupStages.first()->process(buf, *outputs.first());
+        buf.release();
+    }
+    if(in.isAborted())
+        return;
+    for(int a=0; ok && a<groupStages.size(); a++)
+        ok = groupStages.at(a)->finish(*outputs.at(a));
+
+    if(!ok)
+    {
+        if(out.isAborted())
+            return;
+        SETERROR(Err::stageFailed, QString::number(groupIndex));
+        fail();
+        return;
+    }
+    out.close();
+}
+
+void IOPipeline::fail()
+{
+    failed = true;
+    abort();
+}
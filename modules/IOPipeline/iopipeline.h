@@ -0,0 +1,253 @@
+/****************************************************************************}
+{ iopipeline.h - multi-threaded zero-copy stream processing                  }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#pragma once
+
+#include "qiodevicehelper.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+
+// A chunk from QIODeviceChunkPool that has exactly one owner at a time.
+// Stages hand buffers over (std::move) instead of copying the bytes.
+class IOPipelineBuffer
+{
+public:
+    IOPipelineBuffer() = default;
+    explicit IOPipelineBuffer(QIODeviceChunkPool* pool);
+    IOPipelineBuffer(IOPipelineBuffer&& other) noexcept;
+    IOPipelineBuffer& operator=(IOPipelineBuffer&& other) noexcept;
+    IOPipelineBuffer(const IOPipelineBuffer&) = delete;
+    IOPipelineBuffer& operator=(const IOPipelineBuffer&) = delete;
+    ~IOPipelineBuffer();
+
+    inline bool isNull() const {return !ptr;}
+    inline char* data() {return ptr + begin;}
+    inline const char* constData() const {return ptr + begin;}
+    inline int size() const {return sz;}
+    inline int capacity() const {return pool ? pool->chunkSize() - begin : 0;}
+    inline void setSize(int size) {sz = size;}
+    inline void trimFront(int n) {begin += n; sz -= n;}
+    inline QByteArray view() const {return QByteArray::fromRawData(constData(), sz);}
+    void release();
+
+protected:
+    QIODeviceChunkPool* pool {};
+    char* ptr {};
+    int begin {};
+    int sz {};
+};
+
+class IOPipelineQueue
+{
+public:
+    explicit IOPipelineQueue(int capacity);
+
+    // both block; push returns false if the pipeline was aborted,
+    // pop returns false at the end of the stream, on abort or on timeout
+    bool push(IOPipelineBuffer&& buf);
+    bool pop(IOPipelineBuffer& buf, int msecs = -1);
+    // doesn't block; buf is only taken if the queue wasn't full or aborted
+    bool tryPush(IOPipelineBuffer& buf);
+    void close();
+    void abort();
+    // called by the pushing thread after a buffer was added or the queue was closed;
+    // must be set before anything is pushed
+    inline void setNotify(const std::function<void()>& func) {notify = func;}
+
+    bool isFinished() const;
+    bool isAborted() const;
+    bool hasData() const;
+    bool isFull() const;
+
+protected:
+    mutable QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+    std::deque<IOPipelineBuffer> items;
+    const int cap;
+    bool closed;
+    bool aborted;
+    std::function<void()> notify;
+};
+
+class IOPipelineOutput
+{
+public:
+    explicit IOPipelineOutput(QIODeviceChunkPool* pool) : pool(pool){}
+    virtual ~IOPipelineOutput() = default;
+
+    inline IOPipelineBuffer allocate() {return IOPipelineBuffer(pool);}
+    virtual bool push(IOPipelineBuffer&& buf) = 0;
+
+protected:
+    QIODeviceChunkPool* pool;
+};
+
+class IOPipelineStage
+{
+public:
+    virtual ~IOPipelineStage() = default;
+
+    // "in" may be moved to "out" as is, modified in place or dropped
+    virtual bool process(IOPipelineBuffer& in, IOPipelineOutput& out) = 0;
+    // called once after the last buffer
+    virtual bool finish(IOPipelineOutput& out) {Q_UNUSED(out); return true;}
+};
+
+class IOPipelineFunctionStage : public IOPipelineStage
+{
+public:
+    using Func = std::function<bool(IOPipelineBuffer& in, IOPipelineOutput& out)>;
+    explicit IOPipelineFunctionStage(const Func& func) : func(func){}
+    bool process(IOPipelineBuffer& in, IOPipelineOutput& out) override {return func(in, out);}
+
+protected:
+    Func func;
+};
+
+// passes buffers through unchanged while hashing them
+class IOPipelineHashStage : public IOPipelineStage
+{
+public:
+    explicit IOPipelineHashStage(QCryptographicHash::Algorithm algorithm);
+    bool process(IOPipelineBuffer& in, IOPipelineOutput& out) override;
+    // available after the pipeline has finished
+    inline QByteArray result() const {return hash.result();}
+
+protected:
+    QCryptographicHash hash;
+};
+
+// re-cuts the stream so that every buffer ends with '\n' (except the last one);
+// lines longer than a chunk are split
+class IOPipelineLineStage : public IOPipelineStage
+{
+public:
+    bool process(IOPipelineBuffer& in, IOPipelineOutput& out) override;
+    bool finish(IOPipelineOutput& out) override;
+
+protected:
+    IOPipelineBuffer tail;
+};
+
+// zlib or gzip decompression
+class IOPipelineInflateStage : public IOPipelineStage
+{
+public:
+    IOPipelineInflateStage();
+    ~IOPipelineInflateStage() override;
+    bool process(IOPipelineBuffer& in, IOPipelineOutput& out) override;
+    bool finish(IOPipelineOutput& out) override;
+
+protected:
+    void* stream;
+    bool initialized;
+    bool streamEnd;
+};
+
+// Behaves like a socket: readyRead() and readChannelFinished() are emitted
+// from the event loop of the device's thread, read() doesn't block, waitForReadyRead() does.
+class IOPipelineDevice : public QIODeviceHelper<QIODevice>
+{
+public:
+    explicit IOPipelineDevice(IOPipelineQueue* queue, QObject* parent = nullptr);
+
+    bool isSequential() const override {return true;}
+    qint64 bytesAvailable() const override;
+    bool atEnd() const override;
+    bool waitForReadyRead(int msecs) override;
+
+    // zero-copy alternative to read(); returns a null buffer if there's nothing yet or at the end (see atEnd())
+    IOPipelineBuffer takeBuffer();
+
+protected:
+    IOPipelineQueue* queue;
+    IOPipelineBuffer current;
+    std::atomic<bool> notifyPending;
+
+    static QEvent::Type notifyEventType();
+    void postNotify();
+    bool event(QEvent* e) override;
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+};
+
+class IOPipelineSourceReader;
+
+// source -> stage 1 -> ... -> stage N -> device()
+// Every stage added with separateThread = true starts a new thread,
+// otherwise it runs on the thread of the previous stage.
+// Adjacent threads are connected with bounded queues, so a slow stage throttles the ones before it.
+// Sockets and QProcess can only be used from their own thread, so they are read there
+// on readyRead() (that thread needs an event loop, and device()->waitForReadyRead() mustn't be used there);
+// other sources are read by a separate thread.
+class IOPipeline
+{
+    Q_GADGET
+
+public:
+    enum class Err {
+        readSource = 1,
+        stageFailed
+    };
+    Q_ENUM(Err)
+
+    static const int defaultQueueCapacity = 8;
+
+    // with source == nullptr the data is supplied with feed() and closeInput()
+    explicit IOPipeline(QIODevice* source = nullptr, QIODeviceChunkPool* pool = nullptr, int queueCapacity = defaultQueueCapacity);
+    ~IOPipeline();
+    IOPipeline(const IOPipeline&) = delete;
+
+    void addStage(IOPipelineStage* stage, bool separateThread = true);
+    bool start();
+    void abort();
+    bool wait();
+
+    bool feed(IOPipelineBuffer&& buf);
+    bool feed(const char* data, qint64 size);
+    void closeInput();
+    inline IOPipelineBuffer allocate() {return IOPipelineBuffer(pool);}
+
+    inline IOPipelineDevice* device() {return dev.data();}
+    inline bool hasError() const {return failed.load();}
+
+    static QString errorCodeToString(Err errorCode);
+
+protected:
+    struct Group {
+        QVector<IOPipelineStage*> stages;
+    };
+
+    QIODevice* source;
+    QIODeviceChunkPool* pool;
+    int queueCapacity;
+    QVector<IOPipelineStage*> stages;
+    QVector<Group> groups;
+    std::deque<IOPipelineQueue> queues;
+    QVector<QThread*> threads;
+    QScopedPointer<IOPipelineDevice> dev;
+    IOPipelineSourceReader* sourceReader;
+    std::atomic<bool> failed;
+    bool started;
+
+    static bool hasThreadAffinity(QIODevice* dev);
+    void runSource();
+    void sourceFailed();
+    void runGroup(int groupIndex);
+    void fail();
+};
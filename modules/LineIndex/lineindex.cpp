@@ -0,0 +1,267 @@
+/****************************************************************************}
+{ lineindex.cpp - random access to lines of large files                      }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#include "lineindex.h"
+#include <QtConcurrent>
+
+#ifdef Q_OS_UNIX
+    #include <sys/stat.h>
+#endif
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+static const qint64 minParallelChunk = 16 * 1024 * 1024;
+static const qint64 readBlockSize = 1024 * 1024;
+
+static inline quint64 newlineMask64(const char* p)
+{
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    quint64 m0 = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), nl)));
+    quint64 m1 = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)), nl)));
+    quint64 m2 = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32)), nl)));
+    quint64 m3 = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48)), nl)));
+    return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#else
+    quint64 m = 0;
+    for(int a=0; a<64; a++)
+        if(p[a] == '\n')
+            m |= quint64(1) << a;
+    return m;
+#endif
+}
+
+// finds the n-th (1-based) newline and returns its position;
+// if there's not enough newlines returns -1 and decreases n by the number of newlines found
+static qint64 findNthNewline(const char* data, qint64 len, qint64& n)
+{
+    qint64 i = 0;
+    for(; i + 64 <= len; i += 64)
+    {
+        quint64 m = newlineMask64(data + i);
+        qint64 cnt = qPopulationCount(m);
+        if(cnt < n)
+        {
+            n -= cnt;
+            continue;
+        }
+        while(--n)
+            m &= m - 1;
+        return i + qCountTrailingZeroBits(m);
+    }
+    for(; i < len; i++)
+        if(data[i] == '\n' && !--n)
+            return i;
+    return -1;
+}
+
+static qint64 lastNewline(const char* data, qint64 len)
+{
+    for(qint64 i=len-1; i>=0; i--)
+        if(data[i] == '\n')
+            return i;
+    return -1;
+}
+
+LineIndex::LineIndex(int checkpointInterval)
+    :interval(qMax(1, checkpointInterval))
+{
+    clear();
+}
+
+bool LineIndex::build(const QString &filename)
+{
+    clear();
+    this->filename = filename;
+    return extend();
+}
+
+bool LineIndex::extend()
+{
+    QFile file(filename);
+    CHECK(file.open(QIODevice::ReadOnly), Err::openFile, filename);
+    qint64 size = file.size();
+    quint64 device = 0;
+    quint64 inode = 0;
+#ifdef Q_OS_UNIX
+    struct stat st;
+    CHECK(::fstat(file.handle(), &st) == 0, Err::readFile, filename);
+    device = static_cast<quint64>(st.st_dev);
+    inode = static_cast<quint64>(st.st_ino);
+#endif
+    // truncated or replaced by another file: the old offsets are of no use
+    if(size < scanned || device != fileDevice || inode != fileInode)
+        clear();
+    fileDevice = device;
+    fileInode = inode;
+    if(size <= scanned)
+        return true;
+    return scan(file, scanned, size);
+}
+
+void LineIndex::clear()
+{
+    scanned = 0;
+    newlines = 0;
+    lastLineStart = 0;
+    checkpoints.clear();
+    checkpoints.append(0);
+    fileDevice = 0;
+    fileInode = 0;
+}
+
+qint64 LineIndex::lineOffset(QIODevice *dev, qint64 line) const
+{
+    if(line < 0 || line >= lineCount())
+        return -1;
+    qint64 offset = checkpoints.at(static_cast<int>(line / interval));
+    qint64 n = line % interval;
+    if(!n)
+        return offset;
+    if(!dev->seek(offset))
+        return -1;
+
+    QByteArray buf(static_cast<int>(qMin<qint64>(readBlockSize, scanned - offset)), Qt::Uninitialized);
+    while(offset < scanned)
+    {
+        qint64 len = dev->read(buf.data(), qMin<qint64>(buf.size(), scanned - offset));
+        if(len <= 0)
+            return -1;
+        qint64 p = findNthNewline(buf.constData(), len, n);
+        if(p != -1)
+            return offset + p + 1;
+        offset += len;
+    }
+    return -1;
+}
+
+bool LineIndex::seekToLine(QIODevice *dev, qint64 line) const
+{
+    qint64 offset = lineOffset(dev, line);
+    return offset != -1 && dev->seek(offset);
+}
+
+qint64 LineIndex::countNewlines(const char *data, qint64 len)
+{
+    qint64 n = 0;
+    qint64 i = 0;
+    for(; i + 64 <= len; i += 64)
+        n += qPopulationCount(newlineMask64(data + i));
+    for(; i < len; i++)
+        if(data[i] == '\n')
+            n++;
+    return n;
+}
+
+QString LineIndex::errorCodeToString(Err errorCode)
+{
+    switch(errorCode)
+    {
+        case Err::openFile: return QStringLiteral("Cannot open the file");
+        case Err::readFile: return QStringLiteral("Cannot read the file");
+    }
+    return QString();
+}
+
+bool LineIndex::scan(QFile &file, qint64 from, qint64 to)
+{
+    struct Chunk {
+        const char* data;
+        qint64 len;
+        qint64 offset;
+        qint64 firstNewline;
+        qint64 count;
+    };
+
+    uchar* map = file.map(from, to - from);
+    if(map)
+    {
+        const char* data = reinterpret_cast<const char*>(map);
+        qint64 len = to - from;
+        int nChunks = static_cast<int>(qBound<qint64>(1, len / minParallelChunk, QThread::idealThreadCount() * 4));
+        qint64 chunkLen = len / nChunks;
+        QVector<Chunk> chunks;
+        for(int a=0; a<nChunks; a++)
+        {
+            qint64 start = a * chunkLen;
+            qint64 end = a == nChunks - 1 ? len : start + chunkLen;
+            chunks.append({data + start, end - start, from + start, 0, 0});
+        }
+
+        QtConcurrent::blockingMap(chunks, [](Chunk& c){
+            c.count = countNewlines(c.data, c.len);
+        });
+
+        qint64 total = newlines;
+        for(Chunk& c : chunks)
+        {
+            c.firstNewline = total;
+            total += c.count;
+        }
+        checkpoints.resize(static_cast<int>(total / interval + 1));
+        qint64* out = checkpoints.data();
+        QtConcurrent::blockingMap(chunks, [this, out](Chunk& c){
+            scanBlock(c.data, c.len, c.offset, c.firstNewline, out);
+        });
+
+        if(total > newlines)
+            lastLineStart = from + lastNewline(data, len) + 1;
+        newlines = total;
+        scanned = to;
+        file.unmap(map);
+        return true;
+    }
+
+    // not mappable (e.g. a special file): plain sequential scan
+    CHECK(file.seek(from), Err::readFile, filename);
+    QByteArray buf(static_cast<int>(readBlockSize), Qt::Uninitialized);
+    qint64 offset = from;
+    while(offset < to)
+    {
+        qint64 len = file.read(buf.data(), qMin<qint64>(buf.size(), to - offset));
+        CHECK(len > 0, Err::readFile, filename);
+        qint64 count = countNewlines(buf.constData(), len);
+        checkpoints.resize(static_cast<int>((newlines + count) / interval + 1));
+        scanBlock(buf.constData(), len, offset, newlines, checkpoints.data());
+        if(count)
+            lastLineStart = offset + lastNewline(buf.constData(), len) + 1;
+        newlines += count;
+        offset += len;
+        scanned = offset;
+    }
+    return true;
+}
+
+void LineIndex::scanBlock(const char *data, qint64 len, qint64 offset, qint64 firstNewline, qint64 *out) const
+{
+    // the line after the newline number g (0-based, global) is line g+1
+    qint64 line = firstNewline;
+    qint64 toNext = interval - line % interval;
+    qint64 p = 0;
+    forever
+    {
+        qint64 n = toNext;
+        qint64 pos = findNthNewline(data + p, len - p, n);
+        if(pos == -1)
+            break;
+        p += pos + 1;
+        line += toNext;
+        out[line / interval] = offset + p;
+        toNext = interval;
+    }
+}
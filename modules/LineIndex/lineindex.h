@@ -0,0 +1,69 @@
+/****************************************************************************}
+{ lineindex.h - random access to lines of large files                        }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#pragma once
+
+#include "errormanager.h"
+
+// Keeps the offset of every checkpointInterval()-th line of a file.
+// build() scans the file in parallel, extend() picks up data appended later
+// (or rebuilds the index if the file was truncated or replaced, e.g. rotated),
+// seekToLine() jumps to a checkpoint and scans at most checkpointInterval()-1 lines from it.
+class LineIndex
+{
+    Q_GADGET
+
+public:
+    enum class Err {
+        openFile = 1,
+        readFile
+    };
+    Q_ENUM(Err)
+
+    static const int defaultCheckpointInterval = 1024;
+
+    explicit LineIndex(int checkpointInterval = defaultCheckpointInterval);
+
+    bool build(const QString& filename);
+    bool extend();
+    void clear();
+
+    inline const QString& fileName() const {return filename;}
+    inline int checkpointInterval() const {return interval;}
+    inline qint64 scannedSize() const {return scanned;}
+    inline qint64 lineCount() const {return newlines + (scanned > lastLineStart ? 1 : 0);}
+
+    qint64 lineOffset(QIODevice* dev, qint64 line) const;
+    bool seekToLine(QIODevice* dev, qint64 line) const;
+
+    static qint64 countNewlines(const char* data, qint64 len);
+
+    static QString errorCodeToString(Err errorCode);
+
+protected:
+    QString filename;
+    int interval;
+    qint64 scanned;
+    qint64 newlines;
+    qint64 lastLineStart;
+    QVector<qint64> checkpoints;
+    // device and inode of the scanned file (zeros where not available)
+    quint64 fileDevice;
+    quint64 fileInode;
+
+    bool scan(QFile& file, qint64 from, qint64 to);
+    void scanBlock(const char* data, qint64 len, qint64 offset, qint64 firstNewline, qint64* out) const;
+};
@@ -0,0 +1,216 @@
+/****************************************************************************}
+{ processpool.cpp - bounded-concurrency pool of child processes              }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#include "processpool.h"
+
+ProcessPool::ProcessPool(QObject *parent) : ProcessPool(QThread::idealThreadCount(), parent)
+{
+}
+
+ProcessPool::ProcessPool(int maxConcurrency, QObject *parent) : QObject(parent)
+  ,maxConc(qMax(1, maxConcurrency))
+  ,nextId(1)
+  ,startScheduled(false)
+{
+    qRegisterMetaType<ProcessPool::Result>("ProcessPool::Result");
+}
+
+ProcessPool::~ProcessPool()
+{
+    queue.clear();
+    const QList<QProcessEx*> procs = running.keys();
+    running.clear();
+    for(QProcessEx* proc : procs)
+    {
+        proc->disconnect(this);
+        proc->kill();
+        proc->waitForFinished();
+        delete proc;
+    }
+}
+
+void ProcessPool::setMaxConcurrency(int n)
+{
+    maxConc = qMax(1, n);
+    startNext();
+}
+
+int ProcessPool::enqueue(const Job &job)
+{
+    int id = nextId++;
+    queue.enqueue(qMakePair(id, job));
+    startNext();
+    return id;
+}
+
+int ProcessPool::enqueue(const QString &program, const QStringList &arguments)
+{
+    Job job;
+    job.program = program;
+    job.arguments = arguments;
+    return enqueue(job);
+}
+
+bool ProcessPool::waitForAllFinished(int msecs)
+{
+    if(isIdle())
+        return true;
+    QEventLoop loop;
+    connect(this, &ProcessPool::allFinished, &loop, &QEventLoop::quit);
+    if(msecs >= 0)
+        QTimer::singleShot(msecs, &loop, &QEventLoop::quit);
+    loop.exec();
+    return isIdle();
+}
+
+void ProcessPool::cancelPending()
+{
+    if(queue.isEmpty())
+        return;
+    queue.clear();
+    if(running.isEmpty())
+        emit allFinished();
+}
+
+void ProcessPool::killAll()
+{
+    queue.clear();
+    const QList<QProcessEx*> procs = running.keys();
+    for(QProcessEx* proc : procs)
+        proc->kill();
+}
+
+QString ProcessPool::errorCodeToString(Err errorCode)
+{
+    switch(errorCode)
+    {
+        case Err::startProcess: return QStringLiteral("Cannot start the process");
+    }
+    return QString();
+}
+
+void ProcessPool::startJob(int id, const Job &job)
+{
+    QProcessEx* proc = new QProcessEx();
+    proc->setParent(this);
+    if(!job.workingDirectory.isEmpty())
+        proc->setWorkingDirectory(job.workingDirectory);
+    running.insert(proc, {id, job.program, job.userData, QProcess::UnknownError});
+
+    connect(proc, &QProcess::readyReadStandardOutput, this, [this, proc](){
+        readLines(proc, QProcess::StandardOutput);
+    });
+    connect(proc, &QProcess::readyReadStandardError, this, [this, proc](){
+        readLines(proc, QProcess::StandardError);
+    });
+    connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, [this, proc](int exitCode, QProcess::ExitStatus exitStatus){
+        finishJob(proc, exitCode, exitStatus);
+    });
+    connect(proc, &QProcess::errorOccurred, this, [this, proc](QProcess::ProcessError error){
+        auto i = running.find(proc);
+        if(i == running.end())
+            return;
+        i->error = error;
+        // no "finished" signal will follow
+        if(error == QProcess::FailedToStart)
+            finishJob(proc, -1, QProcess::CrashExit);
+    });
+
+    emit jobStarted(id);
+    proc->start(job.program, job.arguments);
+    if(!running.contains(proc))
+        return;
+    if(!job.stdinData.isEmpty())
+        proc->write(job.stdinData);
+    proc->closeWriteChannel();
+}
+
+void ProcessPool::readLines(QProcessEx *proc, QProcess::ProcessChannel channel, bool flush)
+{
+    auto i = running.constFind(proc);
+    if(i == running.constEnd())
+        return;
+    int id = i->id;
+
+    proc->setReadChannel(channel);
+    QString line;
+    while(proc->canReadLine() && proc->readLnUTF8(line))
+    {
+        if(channel == QProcess::StandardOutput)
+            emit stdoutLine(id, line);
+        else
+            emit stderrLine(id, line);
+    }
+
+    if(flush && proc->bytesAvailable())
+    {
+        QByteArray tail = proc->readAll();
+        line = QString::fromUtf8(tail.constData(), tail.size());
+        if(channel == QProcess::StandardOutput)
+            emit stdoutLine(id, line);
+        else
+            emit stderrLine(id, line);
+    }
+}
+
+void ProcessPool::finishJob(QProcessEx *proc, int exitCode, QProcess::ExitStatus exitStatus)
+{
+    auto i = running.constFind(proc);
+    if(i == running.constEnd())
+        return;
+
+    readLines(proc, QProcess::StandardOutput, true);
+    readLines(proc, QProcess::StandardError, true);
+
+    RunningJob job = running.take(proc);
+    proc->disconnect(this);
+    proc->deleteLater();
+
+    Result result;
+    result.id = job.id;
+    result.exitCode = exitCode;
+    result.exitStatus = exitStatus;
+    result.error = job.error;
+    result.started = job.error != QProcess::FailedToStart;
+    result.userData = job.userData;
+    if(!result.started)
+        SETERROR(Err::startProcess, job.program);
+
+    emit jobFinished(result);
+
+    if(isIdle())
+        emit allFinished();
+    else
+        scheduleStart();
+}
+
+void ProcessPool::scheduleStart()
+{
+    if(startScheduled)
+        return;
+    startScheduled = true;
+    QTimer::singleShot(0, this, &ProcessPool::startNext);
+}
+
+void ProcessPool::startNext()
+{
+    startScheduled = false;
+    while(running.size() < maxConc && !queue.isEmpty())
+    {
+        QPair<int, Job> item = queue.dequeue();
+        startJob(item.first, item.second);
+    }
+}
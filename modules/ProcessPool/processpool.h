@@ -0,0 +1,100 @@
+/****************************************************************************}
+{ processpool.h - bounded-concurrency pool of child processes                }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#pragma once
+
+#include "qiodevicehelper.h"
+
+class ProcessPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Err {
+        startProcess = 1
+    };
+    Q_ENUM(Err)
+
+    struct Job {
+        QString program;
+        QStringList arguments;
+        QString workingDirectory;
+        QByteArray stdinData;
+        QVariant userData;
+    };
+
+    struct Result {
+        int id {};
+        int exitCode {-1};
+        QProcess::ExitStatus exitStatus {QProcess::NormalExit};
+        QProcess::ProcessError error {QProcess::UnknownError};
+        bool started {};
+        QVariant userData;
+
+        inline bool isOk() const {return started && exitStatus == QProcess::NormalExit && exitCode == 0;}
+    };
+
+    explicit ProcessPool(QObject* parent = nullptr);
+    explicit ProcessPool(int maxConcurrency, QObject* parent = nullptr);
+    ~ProcessPool() override;
+
+    void setMaxConcurrency(int n);
+    inline int maxConcurrency() const {return maxConc;}
+
+    int enqueue(const Job& job);
+    int enqueue(const QString& program, const QStringList& arguments = QStringList());
+
+    inline int pendingCount() const {return queue.size();}
+    inline int runningCount() const {return running.size();}
+    inline bool isIdle() const {return queue.isEmpty() && running.isEmpty();}
+
+    bool waitForAllFinished(int msecs = -1);
+    void cancelPending();
+    void killAll();
+
+    static QString errorCodeToString(Err errorCode);
+
+protected:
+    struct RunningJob {
+        int id;
+        QString program;
+        QVariant userData;
+        QProcess::ProcessError error;
+    };
+
+    int maxConc;
+    int nextId;
+    bool startScheduled;
+    QQueue<QPair<int, Job>> queue;
+    QHash<QProcessEx*, RunningJob> running;
+
+    void startJob(int id, const Job& job);
+    void readLines(QProcessEx* proc, QProcess::ProcessChannel channel, bool flush = false);
+    void finishJob(QProcessEx* proc, int exitCode, QProcess::ExitStatus exitStatus);
+    void scheduleStart();
+
+protected slots:
+    void startNext();
+
+signals:
+    void jobStarted(int id);
+    void stdoutLine(int id, const QString& line);
+    void stderrLine(int id, const QString& line);
+    void jobFinished(const ProcessPool::Result& result);
+    void allFinished();
+};
+
+Q_DECLARE_METATYPE(ProcessPool::Result)
@@ -16,15 +16,233 @@
 
 #include "qiodevicehelper.h"
 
+#ifdef Q_OS_UNIX
+    #include <fcntl.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+    #include <climits>
+#endif
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+QString QIODeviceHelperErr::formatErrData(const QString &str, qint64 num)
+{
+    QString err;
+    if(!str.isEmpty())
+        err.append("file: "+str+"; ");
+    err.append("pos: ");
+    err.append(QString::number(num));
+    return err;
+}
+
+static inline int asciiPrefix(ushort *dst, const uchar *src, qint64 len)
+{
+    qint64 i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if(_mm_movemask_epi8(chunk))
+            break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(chunk, zero));
+    }
+#endif
+    for(; i < len && src[i] < 0x80; i++)
+        dst[i] = src[i];
+    return static_cast<int>(i);
+}
+
+int QIODeviceHelperText::fromLatin1(ushort *dst, const char *src, qint64 len)
+{
+    const uchar* s = reinterpret_cast<const uchar*>(src);
+    qint64 i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(chunk, zero));
+    }
+#endif
+    for(; i < len; i++)
+        dst[i] = s[i];
+    return static_cast<int>(len);
+}
+
+int QIODeviceHelperText::fromUtf8(ushort *dst, const char *src, qint64 len)
+{
+    const uchar* s = reinterpret_cast<const uchar*>(src);
+    ushort* d = dst;
+    qint64 i = 0;
+    while(i < len)
+    {
+        int n = asciiPrefix(d, s + i, len - i);
+        d += n;
+        i += n;
+        if(i >= len)
+            break;
+
+        uchar c = s[i];
+        uint cp;
+        int extra;
+        uint minCp;
+        if(c >= 0xC2 && c <= 0xDF)
+        {
+            cp = c & 0x1F;
+            extra = 1;
+            minCp = 0x80;
+        }
+        else if((c & 0xF0) == 0xE0)
+        {
+            cp = c & 0x0F;
+            extra = 2;
+            minCp = 0x800;
+        }
+        else if(c >= 0xF0 && c <= 0xF4)
+        {
+            cp = c & 0x07;
+            extra = 3;
+            minCp = 0x10000;
+        }
+        else
+        {
+            *d++ = QChar::ReplacementCharacter;
+            i++;
+            continue;
+        }
+
+        bool ok = i + extra < len;
+        for(int a=1; ok && a<=extra; a++)
+        {
+            uchar cc = s[i + a];
+            if((cc & 0xC0) != 0x80)
+                ok = false;
+            else
+                cp = (cp << 6) | (cc & 0x3F);
+        }
+        if(!ok || cp < minCp || cp > 0x10FFFF || QChar::isSurrogate(cp))
+        {
+            // one replacement character per bad byte
+            *d++ = QChar::ReplacementCharacter;
+            i++;
+            continue;
+        }
+
+        if(QChar::requiresSurrogates(cp))
+        {
+            *d++ = QChar::highSurrogate(cp);
+            *d++ = QChar::lowSurrogate(cp);
+        }
+        else
+        {
+            *d++ = static_cast<ushort>(cp);
+        }
+        i += extra + 1;
+    }
+    return static_cast<int>(d - dst);
+}
+
+qint64 QIODeviceHelperText::utf8Boundary(const char *src, qint64 len)
+{
+    const uchar* s = reinterpret_cast<const uchar*>(src);
+    qint64 j = len - 1;
+    while(j >= 0 && len - j <= 3 && (s[j] & 0xC0) == 0x80)
+        j--;
+    if(j < 0)
+        return len;
+    uchar c = s[j];
+    int seqLen = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    return j + seqLen > len ? j : len;
+}
+
+#ifdef Q_OS_UNIX
+qint64 QIODeviceHelperNative::writeVectored(qintptr fd, const QByteArrayList &buffers, qint64 offset, bool isSocket, bool more)
+{
+    QVarLengthArray<iovec, 64> iov;
+    for(const QByteArray& buf : buffers)
+        if(!buf.isEmpty())
+            iov.append({const_cast<char*>(buf.constData()), static_cast<size_t>(buf.size())});
+
+    if(offset >= 0 && ::lseek(static_cast<int>(fd), offset, SEEK_SET) == -1)
+        return -1;
+
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+
+    qint64 total = 0;
+    int first = 0;
+    while(first < iov.size())
+    {
+        int cnt = qMin(iov.size() - first, IOV_MAX);
+        ssize_t n;
+        if(isSocket)
+        {
+            msghdr msg {};
+            msg.msg_iov = iov.data() + first;
+            msg.msg_iovlen = static_cast<decltype(msg.msg_iovlen)>(cnt);
+            int msgFlags = flags;
+#ifdef MSG_MORE
+            if(more || first + cnt < iov.size())
+                msgFlags |= MSG_MORE;
+#endif
+            n = ::sendmsg(static_cast<int>(fd), &msg, msgFlags);
+        }
+        else
+        {
+            n = ::writev(static_cast<int>(fd), iov.data() + first, cnt);
+        }
+
+        if(n == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            if(isSocket && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            return total ? total : -1;
+        }
+
+        total += n;
+        while(n > 0)
+        {
+            iovec& v = iov[first];
+            if(static_cast<size_t>(n) >= v.iov_len)
+            {
+                n -= v.iov_len;
+                first++;
+            }
+            else
+            {
+                v.iov_base = static_cast<char*>(v.iov_base) + n;
+                v.iov_len -= static_cast<size_t>(n);
+                n = 0;
+            }
+        }
+    }
+    return total;
+}
+#endif
+
 QFileEx::QFileEx(): QIODeviceHelper<QFile>()
   ,doRestore(true)
   ,backupSuffix("~")
+  ,direct(false)
+  ,cacheDropPos(0)
 {
 }
 
 QFileEx::QFileEx(const QString &filename): QIODeviceHelper<QFile>()
   ,doRestore(true)
   ,backupSuffix("~")
+  ,direct(false)
+  ,cacheDropPos(0)
 {
     setFileName(filename);
 }
@@ -36,26 +254,26 @@ QFileEx::~QFileEx()
 
 bool QFileEx::moveToBackup()
 {
-    QString backupFilename(fileName()+backupSuffix);
+    QString backupFilename(filePath()+backupSuffix);
     if(!QFile::remove(backupFilename))
         return false;
-    if(!QFile::rename(fileName(), backupFilename))
+    if(!QFile::rename(filePath(), backupFilename))
         return false;
     return true;
 }
 
 bool QFileEx::openWithBackup(OpenMode mode)
 {
-    QString backupFilename(fileName()+backupSuffix);
+    QString backupFilename(filePath()+backupSuffix);
     QFile::remove(backupFilename);
-    if(QFile::rename(fileName(), backupFilename))
+    if(QFile::rename(filePath(), backupFilename))
         doRestore = true;
     if(!open(mode))
     {
         if(doRestore)
         {
-            QFile::remove(fileName());
-            QFile::rename(backupFilename, fileName());
+            QFile::remove(filePath());
+            QFile::rename(backupFilename, filePath());
             doRestore = false;
         }
         return false;
@@ -66,14 +284,14 @@ bool QFileEx::openWithBackup(OpenMode mode)
 bool QFileEx::restoreFromBackup()
 {
     close(false);
-    QString backupFilename(fileName()+backupSuffix);
-    QFile::remove(fileName());
-    return QFile::rename(backupFilename, fileName());
+    QString backupFilename(filePath()+backupSuffix);
+    QFile::remove(filePath());
+    return QFile::rename(backupFilename, filePath());
 }
 
 void QFileEx::removeBackup()
 {
-    QString backupFilename(fileName()+backupSuffix);
+    QString backupFilename(filePath()+backupSuffix);
     QFile::remove(backupFilename);
 }
 
@@ -85,7 +303,143 @@ void QFileEx::close(bool doRemoveBackupOnClose)
         if(doRemoveBackupOnClose)
             removeBackup();
     }
+    cacheDropPos = 0;
     QIODeviceHelper<QFile>::close();
+    if(direct)
+    {
+        direct = false;
+        setFileName(directFileName);
+        directFileName.clear();
+    }
+}
+
+bool QFileEx::advise(Advice advice, qint64 offset, qint64 len)
+{
+#ifdef Q_OS_LINUX
+    int fd = handle();
+    if(fd == -1)
+        return false;
+    int a;
+    switch(advice)
+    {
+        case Advice::sequential: a = POSIX_FADV_SEQUENTIAL; break;
+        case Advice::random: a = POSIX_FADV_RANDOM; break;
+        case Advice::willNeed: a = POSIX_FADV_WILLNEED; break;
+        case Advice::dontNeed: a = POSIX_FADV_DONTNEED; break;
+        case Advice::noReuse: a = POSIX_FADV_NOREUSE; break;
+        default: a = POSIX_FADV_NORMAL;
+    }
+    return ::posix_fadvise(fd, offset, len, a) == 0;
+#else
+    Q_UNUSED(advice);
+    Q_UNUSED(offset);
+    Q_UNUSED(len);
+    return false;
+#endif
+}
+
+bool QFileEx::dropCacheBehind()
+{
+#ifdef Q_OS_LINUX
+    static const qint64 pageSize = ::sysconf(_SC_PAGESIZE);
+    qint64 end = pos() & ~(pageSize - 1);
+    if(end <= cacheDropPos)
+        return true;
+    // DONTNEED skips dirty pages, so the written ones must reach the disk first
+    if(isWritable())
+    {
+        if(!flush())
+            return false;
+        int fd = handle();
+        if(fd == -1)
+            return false;
+        int res;
+        do
+        {
+            res = ::sync_file_range(fd, cacheDropPos, end - cacheDropPos,
+                                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        }
+        while(res == -1 && errno == EINTR);
+        if(res == -1)
+            return false;
+    }
+    if(!advise(Advice::dontNeed, cacheDropPos, end - cacheDropPos))
+        return false;
+    cacheDropPos = end;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool QFileEx::preallocate(qint64 size)
+{
+#ifdef Q_OS_LINUX
+    int fd = handle();
+    if(fd == -1)
+        return false;
+    int res;
+    do
+    {
+        res = ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+    }
+    while(res == -1 && errno == EINTR);
+    return res == 0;
+#else
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
+bool QFileEx::openDirect(OpenMode mode)
+{
+#ifdef Q_OS_LINUX
+    if(isOpen())
+        return false;
+
+    int flags = O_CLOEXEC | O_DIRECT;
+    if((mode & ReadWrite) == ReadWrite)
+        flags |= O_RDWR | O_CREAT;
+    else if(mode & WriteOnly)
+        flags |= O_WRONLY | O_CREAT;
+    else
+        flags |= O_RDONLY;
+    if(mode & Append)
+        flags |= O_APPEND;
+    // same as QFile: WriteOnly implies Truncate unless combined with ReadOnly or Append
+    if((mode & Truncate) || ((mode & WriteOnly) && !(mode & (ReadOnly | Append))))
+        flags |= O_TRUNC;
+
+    int fd = ::open(QFile::encodeName(fileName()).constData(), flags, 0666);
+    if(fd == -1)
+        return false;
+    QString name = fileName();
+    if(!QFile::open(fd, mode | Unbuffered, AutoCloseHandle))
+    {
+        ::close(fd);
+        setFileName(name);
+        return false;
+    }
+    // QFile forgets the name when opened by a descriptor, close() puts it back
+    directFileName = name;
+    direct = true;
+    cacheDropPos = 0;
+    return true;
+#else
+    Q_UNUSED(mode);
+    return false;
+#endif
+}
+
+char *QFileEx::allocDirectBuffer(qint64 size)
+{
+    qint64 alignedSize = (size + directAlignment() - 1) & ~(directAlignment() - 1);
+    return static_cast<char*>(qMallocAligned(static_cast<size_t>(alignedSize), static_cast<size_t>(directAlignment())));
+}
+
+void QFileEx::freeDirectBuffer(char *buf)
+{
+    qFreeAligned(buf);
 }
 
 bool QFileEx::throwError()
@@ -95,12 +449,249 @@ bool QFileEx::throwError()
     return QIODeviceHelper<QFile>::throwError();
 }
 
-QString QFileEx::getErrDataStr()
+ErrorManager::ErrorData QFileEx::getErrData()
 {
-    QString err = QIODeviceHelper<QFile>::getErrDataStr();
-    if(!this->fileName().isEmpty())
-        err.prepend("file: "+this->fileName()+"; ");
-    return err;
+    ErrorManager::ErrorData data = QIODeviceHelper<QFile>::getErrData();
+    data.str = filePath();
+    return data;
+}
+
+QIODeviceChunkPool::QIODeviceChunkPool(int chunkSize, int maxFreeChunks)
+    :chunkSz(chunkSize)
+    ,maxFree(maxFreeChunks)
+{
+}
+
+QIODeviceChunkPool::~QIODeviceChunkPool()
+{
+    for(char* chunk : qAsConst(freeChunks))
+        delete[] chunk;
+}
+
+QIODeviceChunkPool *QIODeviceChunkPool::instance()
+{
+    static QIODeviceChunkPool pool;
+    return &pool;
+}
+
+char *QIODeviceChunkPool::take()
+{
+    {
+        QMutexLocker locker(&mutex);
+        if(!freeChunks.isEmpty())
+            return freeChunks.takeLast();
+    }
+    return new char[static_cast<size_t>(chunkSz)];
+}
+
+void QIODeviceChunkPool::give(char *chunk)
+{
+    {
+        QMutexLocker locker(&mutex);
+        if(freeChunks.size() < maxFree)
+        {
+            freeChunks.append(chunk);
+            return;
+        }
+    }
+    delete[] chunk;
+}
+
+
+QChunkedBufferEx::QChunkedBufferEx(QIODeviceChunkPool *pool, QObject *parent)
+    : QIODeviceHelper<QIODevice>(parent)
+    ,pool(pool ? pool : QIODeviceChunkPool::instance())
+    ,dataSize(0)
+{
+}
+
+QChunkedBufferEx::~QChunkedBufferEx()
+{
+    clear();
+}
+
+bool QChunkedBufferEx::open(OpenMode mode)
+{
+    if(mode & (Append | Truncate))
+        mode |= WriteOnly;
+    if(!(mode & ReadWrite))
+        return false;
+    if(mode & Truncate)
+        clear();
+    return QIODeviceHelper<QIODevice>::open(mode | Unbuffered);
+}
+
+void QChunkedBufferEx::close()
+{
+    QIODeviceHelper<QIODevice>::close();
+}
+
+bool QChunkedBufferEx::seek(qint64 pos)
+{
+    if(pos > dataSize)
+    {
+        if(!isWritable())
+            return false;
+        fill(dataSize, pos, nullptr);
+    }
+    return QIODeviceHelper<QIODevice>::seek(pos);
+}
+
+bool QChunkedBufferEx::atEnd() const
+{
+    return isOpen() && pos() >= dataSize;
+}
+
+bool QChunkedBufferEx::canReadLine() const
+{
+    if(!isOpen())
+        return false;
+    const qint64 cs = pool->chunkSize();
+    qint64 p = pos();
+    while(p < dataSize)
+    {
+        qint64 offset = p % cs;
+        qint64 len = qMin(cs - offset, dataSize - p);
+        if(memchr(chunks.at(static_cast<int>(p / cs)) + offset, '\n', static_cast<size_t>(len)))
+            return true;
+        p += len;
+    }
+    return QIODeviceHelper<QIODevice>::canReadLine();
+}
+
+void QChunkedBufferEx::clear()
+{
+    for(char* chunk : qAsConst(chunks))
+        pool->give(chunk);
+    chunks.clear();
+    dataSize = 0;
+    if(isOpen())
+        QIODeviceHelper<QIODevice>::seek(0);
+}
+
+void QChunkedBufferEx::reserve(qint64 size)
+{
+    const qint64 cs = pool->chunkSize();
+    while(static_cast<qint64>(chunks.size()) * cs < size)
+        chunks.append(pool->take());
+}
+
+void QChunkedBufferEx::setData(const QByteArray &data)
+{
+    setData(data.constData(), data.size());
+}
+
+void QChunkedBufferEx::setData(const char *data, qint64 size)
+{
+    clear();
+    fill(0, size, data);
+}
+
+QByteArray QChunkedBufferEx::data() const
+{
+    QByteArray result;
+    result.reserve(static_cast<int>(dataSize));
+    for(const QByteArray& view : gatherView())
+        result.append(view);
+    return result;
+}
+
+QByteArrayList QChunkedBufferEx::gatherView() const
+{
+    QByteArrayList views;
+    const qint64 cs = pool->chunkSize();
+    qint64 left = dataSize;
+    for(int a=0; left > 0; a++)
+    {
+        int len = static_cast<int>(qMin(cs, left));
+        views.append(QByteArray::fromRawData(chunks.at(a), len));
+        left -= len;
+    }
+    return views;
+}
+
+bool QChunkedBufferEx::writeTo(QIODevice *dev) const
+{
+    for(const QByteArray& view : gatherView())
+        if(dev->write(view.constData(), view.size()) != view.size())
+            return false;
+    return true;
+}
+
+void QChunkedBufferEx::fill(qint64 from, qint64 to, const char *data)
+{
+    reserve(to);
+    const qint64 cs = pool->chunkSize();
+    qint64 p = from;
+    while(p < to)
+    {
+        qint64 offset = p % cs;
+        qint64 len = qMin(cs - offset, to - p);
+        char* dst = chunks.at(static_cast<int>(p / cs)) + offset;
+        if(data)
+        {
+            memcpy(dst, data, static_cast<size_t>(len));
+            data += len;
+        }
+        else
+        {
+            memset(dst, 0, static_cast<size_t>(len));
+        }
+        p += len;
+    }
+    if(to > dataSize)
+        dataSize = to;
+}
+
+qint64 QChunkedBufferEx::readData(char *data, qint64 maxSize)
+{
+    const qint64 cs = pool->chunkSize();
+    qint64 p = pos();
+    qint64 n = qMin(maxSize, dataSize - p);
+    if(n <= 0)
+        return 0;
+    qint64 end = p + n;
+    while(p < end)
+    {
+        qint64 offset = p % cs;
+        qint64 len = qMin(cs - offset, end - p);
+        memcpy(data, chunks.at(static_cast<int>(p / cs)) + offset, static_cast<size_t>(len));
+        data += len;
+        p += len;
+    }
+    return n;
+}
+
+qint64 QChunkedBufferEx::writeData(const char *data, qint64 maxSize)
+{
+    qint64 p = pos();
+    if(p > dataSize)
+        fill(dataSize, p, nullptr);
+    fill(p, p + maxSize, data);
+    return maxSize;
+}
+
+qint64 QChunkedBufferEx::readLineData(char *data, qint64 maxSize)
+{
+    const qint64 cs = pool->chunkSize();
+    qint64 p = pos();
+    qint64 end = qMin(p + maxSize, dataSize);
+    qint64 readSoFar = 0;
+    while(p < end)
+    {
+        qint64 offset = p % cs;
+        qint64 len = qMin(cs - offset, end - p);
+        const char* src = chunks.at(static_cast<int>(p / cs)) + offset;
+        const char* nl = static_cast<const char*>(memchr(src, '\n', static_cast<size_t>(len)));
+        if(nl)
+            len = nl - src + 1;
+        memcpy(data + readSoFar, src, static_cast<size_t>(len));
+        readSoFar += len;
+        p += len;
+        if(nl)
+            break;
+    }
+    return readSoFar;
 }
 
 
@@ -121,10 +712,239 @@ bool QSaveFileEx::throwError()
     return QIODeviceHelper<QSaveFile>::throwError();
 }
 
-QString QSaveFileEx::getErrDataStr()
+ErrorManager::ErrorData QSaveFileEx::getErrData()
 {
-    QString err = QIODeviceHelper<QSaveFile>::getErrDataStr();
-    if(!this->fileName().isEmpty())
-        err.prepend("file: "+this->fileName()+"; ");
-    return err;
+    ErrorManager::ErrorData data = QIODeviceHelper<QSaveFile>::getErrData();
+    data.str = this->fileName();
+    return data;
+}
+
+
+namespace {
+    const char journalMagic[4] = {'Q', 'S', 'F', 'J'};
+    const quint32 journalVersion = 1;
+    const qint64 journalHeaderSize = 4 + 4 + 8 + 8;
+
+    // type (1) + a (8) + b (8) + header checksum (2) + data checksum (2);
+    // region records: a = offset, b = size, followed by the data;
+    // commit records: a = content size, b = 0
+    const qint64 recordHeaderSize = 1 + 8 + 8 + 2 + 2;
+    const char recordRegion = 1;
+    const char recordCommit = 2;
+}
+
+QSaveFileJournal::QSaveFileJournal(const QString &filename)
+    :filename(filename)
+    ,threshold(defaultCompactThreshold)
+{
+    journal.setFileName(journalFileName());
+}
+
+QSaveFileJournal::~QSaveFileJournal()
+{
+    journal.close();
+}
+
+bool QSaveFileJournal::load(QByteArray &content)
+{
+    content.clear();
+
+    QFile base(filename);
+    if(base.exists())
+    {
+        CHECK(base.open(QIODevice::ReadOnly), Err::readBase, filename);
+        content = base.readAll();
+        CHECK(content.size() == base.size(), Err::readBase, filename);
+    }
+
+    return openJournal(&content);
+}
+
+bool QSaveFileJournal::save(const QByteArray &content, const QVector<Region> &changed)
+{
+    if(!QFile::exists(filename))
+        return compact(content);
+    if(!journal.isOpen() && !openJournal())
+        return false;
+
+    qint64 total = 0;
+    for(const Region& r : changed)
+        total += r.size;
+    if(journal.size() + total > threshold)
+        return compact(content);
+
+    QByteArrayList bufs;
+    for(const Region& r : changed)
+    {
+        qint64 offset = qBound<qint64>(0, r.offset, content.size());
+        qint64 size = qBound<qint64>(0, r.size, content.size() - offset);
+        if(!size)
+            continue;
+        const char* data = content.constData() + offset;
+        bufs.append(recordHeader(recordRegion, offset, size, data, size));
+        bufs.append(QByteArray::fromRawData(data, static_cast<int>(size)));
+    }
+    bufs.append(recordHeader(recordCommit, content.size(), 0, nullptr, 0));
+
+    qint64 pos = journal.size();
+    if(!journal.seek(pos) || !journal.writeVectored(bufs))
+    {
+        journal.resize(pos);
+        SETERROR(Err::writeJournal, journalFileName());
+        return false;
+    }
+    return syncJournal();
+}
+
+bool QSaveFileJournal::compact(const QByteArray &content)
+{
+    QSaveFileEx f(filename);
+    CHECK(f.open(QIODevice::WriteOnly), Err::commitBase, filename);
+    if(f.write(content) != content.size())
+    {
+        f.cancelWriting();
+        SETERROR(Err::commitBase, filename);
+        return false;
+    }
+    CHECK(f.commit(), Err::commitBase, filename);
+
+    // the journal is bound to the old base file (see journalHeader),
+    // so even if it survives a crash right here it won't be replayed
+    journal.close();
+    QFile::remove(journalFileName());
+    return true;
+}
+
+QString QSaveFileJournal::errorCodeToString(Err errorCode)
+{
+    switch(errorCode)
+    {
+        case Err::readBase: return QStringLiteral("Cannot read the base file");
+        case Err::openJournal: return QStringLiteral("Cannot open the journal");
+        case Err::writeJournal: return QStringLiteral("Cannot write to the journal");
+        case Err::commitBase: return QStringLiteral("Cannot commit the base file");
+    }
+    return QString();
+}
+
+bool QSaveFileJournal::openJournal(QByteArray *content)
+{
+    journal.close();
+    CHECK(journal.open(QIODevice::ReadWrite), Err::openJournal, journalFileName());
+
+    QByteArray header = journalHeader();
+    if(journal.size() >= journalHeaderSize && journal.read(journalHeaderSize) == header)
+        return replayJournal(content);
+
+    // missing, stale or foreign journal
+    if(!journal.resize(0) || !journal.seek(0) || journal.write(header) != header.size() || !syncJournal())
+    {
+        journal.close();
+        SETERROR(Err::openJournal, journalFileName());
+        return false;
+    }
+    return true;
+}
+
+bool QSaveFileJournal::syncJournal()
+{
+    CHECK(journal.flush(), Err::writeJournal, journalFileName());
+#ifdef Q_OS_UNIX
+    CHECK(::fsync(journal.handle()) == 0, Err::writeJournal, journalFileName());
+#endif
+    return true;
+}
+
+bool QSaveFileJournal::replayJournal(QByteArray *content)
+{
+    struct Pending {
+        qint64 offset;
+        QByteArray data;
+    };
+    QVector<Pending> pending;
+    qint64 committedPos = journalHeaderSize;
+    qint64 journalEnd = journal.size();
+
+    CHECK(journal.seek(journalHeaderSize), Err::openJournal, journalFileName());
+    while(journal.pos() + recordHeaderSize <= journalEnd)
+    {
+        char h[recordHeaderSize];
+        if(journal.read(h, recordHeaderSize) != recordHeaderSize)
+            break;
+        char type = h[0];
+        qint64 a = qFromLittleEndian<qint64>(h + 1);
+        qint64 b = qFromLittleEndian<qint64>(h + 9);
+        quint16 headerChecksum = qFromLittleEndian<quint16>(h + 17);
+        quint16 dataChecksum = qFromLittleEndian<quint16>(h + 19);
+        if(headerChecksum != qChecksum(h, 17) || a < 0 || b < 0)
+            break;
+
+        if(type == recordRegion)
+        {
+            if(journal.pos() + b > journalEnd)
+                break;
+            QByteArray data = journal.read(b);
+            if(data.size() != b || qChecksum(data.constData(), static_cast<uint>(data.size())) != dataChecksum)
+                break;
+            if(content)
+                pending.append({a, data});
+        }
+        else if(type == recordCommit)
+        {
+            if(content)
+            {
+                for(const Pending& p : qAsConst(pending))
+                {
+                    qint64 end = p.offset + p.data.size();
+                    if(end > content->size())
+                    {
+                        int oldSize = content->size();
+                        content->resize(static_cast<int>(end));
+                        memset(content->data() + oldSize, 0, static_cast<size_t>(end - oldSize));
+                    }
+                    memcpy(content->data() + p.offset, p.data.constData(), static_cast<size_t>(p.data.size()));
+                }
+                int oldSize = content->size();
+                content->resize(static_cast<int>(a));
+                if(a > oldSize)
+                    memset(content->data() + oldSize, 0, static_cast<size_t>(a - oldSize));
+            }
+            pending.clear();
+            committedPos = journal.pos();
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // drop a partially written save, so that new records follow the last complete one
+    if(committedPos != journalEnd)
+        CHECK(journal.resize(committedPos), Err::openJournal, journalFileName());
+    CHECK(journal.seek(committedPos), Err::openJournal, journalFileName());
+    return true;
+}
+
+QByteArray QSaveFileJournal::journalHeader() const
+{
+    QFileInfo info(filename);
+    QByteArray header(static_cast<int>(journalHeaderSize), Qt::Uninitialized);
+    char* h = header.data();
+    memcpy(h, journalMagic, 4);
+    qToLittleEndian<quint32>(journalVersion, h + 4);
+    qToLittleEndian<qint64>(info.exists() ? info.size() : -1, h + 8);
+    qToLittleEndian<qint64>(info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1, h + 16);
+    return header;
+}
+
+QByteArray QSaveFileJournal::recordHeader(char type, qint64 a, qint64 b, const char *data, qint64 size)
+{
+    QByteArray header(static_cast<int>(recordHeaderSize), Qt::Uninitialized);
+    char* h = header.data();
+    h[0] = type;
+    qToLittleEndian<qint64>(a, h + 1);
+    qToLittleEndian<qint64>(b, h + 9);
+    qToLittleEndian<quint16>(qChecksum(h, 17), h + 17);
+    qToLittleEndian<quint16>(data ? qChecksum(data, static_cast<uint>(size)) : 0, h + 19);
+    return header;
 }
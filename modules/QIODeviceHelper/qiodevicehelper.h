@@ -31,8 +31,27 @@ namespace QIODeviceHelperErr {
         write
     };
     Q_ENUM_NS(Err)
+
+    // "file: <str>; pos: <num>", without the file part if str is empty
+    QString formatErrData(const QString& str, qint64 num);
+}
+
+namespace QIODeviceHelperText {
+    // both write at most len UTF-16 code units to dst and return the number of units written
+    int fromUtf8(ushort* dst, const char* src, qint64 len);
+    int fromLatin1(ushort* dst, const char* src, qint64 len);
+    // length of the longest prefix of src that doesn't end in the middle of a UTF-8 sequence
+    qint64 utf8Boundary(const char* src, qint64 len);
 }
 
+#ifdef Q_OS_UNIX
+namespace QIODeviceHelperNative {
+    // returns the number of bytes written (may be partial for non-blocking sockets) or -1;
+    // offset == -1 writes at the current descriptor position
+    qint64 writeVectored(qintptr fd, const QByteArrayList& buffers, qint64 offset, bool isSocket, bool more);
+}
+#endif
+
 template <typename T> class QIODeviceHelper : public T
 {
 public:
@@ -152,28 +171,32 @@ public:
 
     inline QString readStringUTF8(char stopChar = 0)
     {
-        QByteArray utf = readUntilChar(stopChar);
-        return QString::fromUtf8(utf.constData());
+        QString s;
+        readDecoded(s, true, false, stopChar, false);
+        return s;
     }
 
     inline QString readStringASCII(char stopChar = 0)
     {
-        QByteArray ascii = readUntilChar(stopChar);
-        return  QString::fromLatin1(ascii.constData());
+        QString s;
+        readDecoded(s, false, false, stopChar, false);
+        return s;
     }
 
     inline QString readString(char stopChar = 0){return readStringUTF8(stopChar);}
 
     inline QString readLineUTF8()
     {
-        QByteArray utf = readUntilReturn();
-        return QString::fromUtf8(utf.constData());
+        QString s;
+        readDecoded(s, true, true, 0, true);
+        return s;
     }
 
     inline QString readLineASCII()
     {
-        QByteArray ascii = readUntilReturn();
-        return QString::fromLatin1(ascii.constData());
+        QString s;
+        readDecoded(s, false, true, 0, true);
+        return s;
     }
 
     inline bool readLn(QByteArray& data)
@@ -201,7 +224,7 @@ public:
         QByteArray data;
         if(!readLn(data))
             return false;
-        dstString = QString::fromLatin1(data.constData());
+        dstString = QString::fromLatin1(data.constData(), data.size());
         return true;
     }
 
@@ -210,7 +233,7 @@ public:
         QByteArray data;
         if(!readLn(data))
             return false;
-        dstString = QString::fromUtf8(data.constData());
+        dstString = QString::fromUtf8(data.constData(), data.size());
         return true;
     }
 
@@ -262,6 +285,52 @@ public:
         return true;
     }
 
+    // writes all buffers as if they were concatenated;
+    // set "more" if another write will follow immediately (MSG_MORE for sockets)
+    inline bool writeVectored(const QByteArrayList& buffers, bool more = false)
+    {
+        qint64 total = 0;
+        for(const QByteArray& buf : buffers)
+            total += buf.size();
+        if(!total)
+            return true;
+
+        qint64 written = writeVectoredNative(buffers, more);
+        if(written == -1)
+            return throwWriteError();
+        if(written == total)
+            return true;
+
+        // the device has its own write buffer, so writing piece by piece is a single copy anyway
+        bool concat = this->openMode().testFlag(QIODevice::Unbuffered);
+        QByteArray data;
+        if(concat)
+            data.reserve(static_cast<int>(total - written));
+        for(const QByteArray& buf : buffers)
+        {
+            if(written >= buf.size())
+            {
+                written -= buf.size();
+                continue;
+            }
+            const char* ptr = buf.constData() + written;
+            qint64 len = buf.size() - written;
+            written = 0;
+            if(concat)
+                data.append(ptr, static_cast<int>(len));
+            else if(this->write(ptr, len) != len)
+                return throwWriteError();
+        }
+        if(concat)
+            return this->write(data) == data.size() ? true:throwWriteError();
+        return true;
+    }
+
+    inline bool writeVectored(std::initializer_list<QByteArray> buffers, bool more = false)
+    {
+        return writeVectored(QByteArrayList(buffers), more);
+    }
+
     inline bool writeInt(qint8 value)
     {
         return this->write(reinterpret_cast<const char*>(&value), sizeof(value)) == sizeof(value) ? true:throwWriteError();
@@ -471,24 +540,142 @@ protected:
 
     bool throwReadError()
     {
-        QString errDataStr = getErrDataStr();
-        SETERROR(QIODeviceHelperErr::Err::read, errDataStr);
+        SETERROR(QIODeviceHelperErr::Err::read, getErrData());
         return throwError();
     }
 
     bool throwWriteError()
     {
-        QString errDataStr = getErrDataStr();
-        SETERROR(QIODeviceHelperErr::Err::write, errDataStr);
+        SETERROR(QIODeviceHelperErr::Err::write, getErrData());
         return throwError();
     }
 
-    virtual QString getErrDataStr()
+    // same semantics as readUntilChar/readUntilReturn followed by a conversion,
+    // but decodes straight from the device's buffer into dst
+    bool readDecoded(QString& dst, bool utf8, bool untilReturn, char stopChar, bool allowEof)
     {
-        QString err;
-        err.append("pos: ");
-        err.append(QString::number(this->pos()));
-        return err;
+        dst.clear();
+        char buf[4096];
+        qint64 bytesDone = 0;
+        forever
+        {
+            qint64 n = this->peek(buf, sizeof(buf));
+            if(n <= 0)
+                break;
+
+            const char* stop;
+            if(untilReturn)
+            {
+                stop = static_cast<const char*>(memchr(buf, '\n', static_cast<size_t>(n)));
+                const char* cr = static_cast<const char*>(memchr(buf, '\r', static_cast<size_t>(stop ? stop - buf : n)));
+                if(cr)
+                    stop = cr;
+            }
+            else
+            {
+                stop = static_cast<const char*>(memchr(buf, stopChar, static_cast<size_t>(n)));
+            }
+
+            qint64 dataLen = stop ? stop - buf : n;
+            if(!stop && utf8)
+            {
+                // leave an incomplete sequence for the next round
+                qint64 boundary = QIODeviceHelperText::utf8Boundary(buf, dataLen);
+                if(boundary)
+                    dataLen = boundary;
+            }
+
+            int oldSize = dst.size();
+            dst.resize(oldSize + static_cast<int>(dataLen));
+            ushort* out = reinterpret_cast<ushort*>(dst.data()) + oldSize;
+            int decoded = utf8
+                ? QIODeviceHelperText::fromUtf8(out, buf, dataLen)
+                : QIODeviceHelperText::fromLatin1(out, buf, dataLen);
+            dst.resize(oldSize + decoded);
+
+            qint64 consumed = dataLen + (stop ? 1 : 0);
+            if(!skipBytes(consumed))
+                break;
+            bytesDone += consumed;
+
+            if(stop)
+            {
+                if(untilReturn)
+                {
+                    char c = *stop;
+                    char pair = c == '\n' ? '\r' : '\n';
+                    if(this->peek(&c, 1) == 1 && c == pair)
+                        this->getChar(&c);
+                }
+                return true;
+            }
+        }
+        if(!this->atEnd() || !allowEof || !bytesDone)
+            return throwReadError();
+        return true;
+    }
+
+    inline bool skipBytes(qint64 n)
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+        return this->skip(n) == n;
+#else
+        char buf[4096];
+        while(n > 0)
+        {
+            qint64 chunk = qMin<qint64>(n, sizeof(buf));
+            if(this->read(buf, chunk) != chunk)
+                return false;
+            n -= chunk;
+        }
+        return true;
+#endif
+    }
+
+    // the position (and the file name in QFileEx/QSaveFileEx) is formatted only when the error is read
+    virtual ErrorManager::ErrorData getErrData()
+    {
+        return ErrorManager::ErrorData(&QIODeviceHelperErr::formatErrData, QString(), this->pos());
+    }
+
+    // returns the number of bytes written directly to the native descriptor
+    // (0 if the device has no usable descriptor) or -1 on error
+    qint64 writeVectoredNative(const QByteArrayList& buffers, bool more)
+    {
+#ifdef Q_OS_UNIX
+        if constexpr(std::is_base_of<QFileDevice, T>::value)
+        {
+            Q_UNUSED(more);
+            if(this->openMode() & QIODevice::Append)
+                return 0;
+            int fd = this->handle();
+            if(fd == -1 || !this->flush())
+                return 0;
+            // pipes and other sequential files can't lseek(), they are written at the current position
+            if(this->isSequential())
+                return QIODeviceHelperNative::writeVectored(fd, buffers, -1, false, false);
+            qint64 p = this->pos();
+            qint64 n = QIODeviceHelperNative::writeVectored(fd, buffers, p, false, false);
+            if(n > 0 && !this->seek(p + n))
+                return -1;
+            return n;
+        }
+#ifdef QT_NETWORK_LIB
+        else if constexpr(std::is_base_of<QAbstractSocket, T>::value || std::is_base_of<QLocalSocket, T>::value)
+        {
+            // anything already queued by Qt must go first; TLS sockets can't be bypassed at all
+            if(this->bytesToWrite() || !this->isWritable() || this->inherits("QSslSocket"))
+                return 0;
+            qintptr fd = this->socketDescriptor();
+            if(fd == -1)
+                return 0;
+            return QIODeviceHelperNative::writeVectored(fd, buffers, -1, true, more);
+        }
+#endif
+#endif
+        Q_UNUSED(buffers);
+        Q_UNUSED(more);
+        return 0;
     }
 };
 
@@ -533,6 +720,66 @@ protected:
 
 class QBufferEx: public QIODeviceHelper<QBuffer>{};
 
+class QIODeviceChunkPool {
+public:
+    static const int defaultChunkSize = 64 * 1024;
+    static const int defaultMaxFreeChunks = 256;
+
+    explicit QIODeviceChunkPool(int chunkSize = defaultChunkSize, int maxFreeChunks = defaultMaxFreeChunks);
+    ~QIODeviceChunkPool();
+    QIODeviceChunkPool(const QIODeviceChunkPool&) = delete;
+
+    static QIODeviceChunkPool* instance();
+
+    char* take();
+    void give(char* chunk);
+    inline int chunkSize() const {return chunkSz;}
+
+protected:
+    const int chunkSz;
+    const int maxFree;
+    QMutex mutex;
+    QVector<char*> freeChunks;
+};
+
+// in-memory device that stores data in fixed-size chunks from QIODeviceChunkPool;
+// growing never moves the bytes that were already written;
+// pool == nullptr means QIODeviceChunkPool::instance()
+class QChunkedBufferEx: public QIODeviceHelper<QIODevice> {
+public:
+    QChunkedBufferEx(QIODeviceChunkPool* pool = nullptr, QObject* parent = nullptr);
+    ~QChunkedBufferEx();
+
+    virtual bool open(OpenMode mode);
+    virtual void close();
+    virtual qint64 size() const {return dataSize;}
+    virtual bool seek(qint64 pos);
+    virtual bool atEnd() const;
+    virtual bool canReadLine() const;
+
+    void clear();
+    void reserve(qint64 size);
+    void setData(const QByteArray& data);
+    void setData(const char* data, qint64 size);
+    QByteArray data() const;
+
+    // raw (non-owning) views of the chunks in order; valid until the next write, clear or destruction
+    QByteArrayList gatherView() const;
+    bool writeTo(QIODevice* dev) const;
+
+    inline QIODeviceChunkPool* getPool() const {return pool;}
+
+protected:
+    QIODeviceChunkPool* pool;
+    QVector<char*> chunks;
+    qint64 dataSize;
+
+    void fill(qint64 from, qint64 to, const char* data);
+    virtual qint64 readData(char * data, qint64 maxSize);
+    virtual qint64 writeData(const char * data, qint64 maxSize);
+    virtual qint64 readLineData(char * data, qint64 maxSize);
+};
+
 class QFileEx: public QIODeviceHelper<QFile> {
 public:
     QFileEx();
@@ -545,11 +792,42 @@ public:
     void close(bool doRemoveBackupOnClose);
     virtual void close(){close(true);}
     inline const QString& getBackupSuffix() const {return backupSuffix;}
+
+    // page cache hints; all of them are no-ops returning false where not supported
+    enum class Advice {
+        normal,
+        sequential,
+        random,
+        willNeed,
+        dontNeed,
+        noReuse
+    };
+    bool advise(Advice advice, qint64 offset = 0, qint64 len = 0);
+    // evicts already consumed or written data (up to pos()) from the page cache;
+    // written data is flushed to the disk first, so this waits for the I/O
+    bool dropCacheBehind();
+    // reserves disk space without changing the file size
+    bool preallocate(qint64 size);
+
+    // opens the file with O_DIRECT (always unbuffered);
+    // reads and writes must use buffers, sizes and offsets aligned to directAlignment().
+    // The file is opened by its descriptor, so fileName() is empty until close() (use filePath()).
+    bool openDirect(OpenMode mode);
+    inline bool isDirect() const {return direct;}
+    // the same as fileName(), but also while the file is opened with openDirect()
+    inline QString filePath() const {return direct ? directFileName : fileName();}
+    static constexpr qint64 directAlignment() {return 4096;}
+    static char* allocDirectBuffer(qint64 size);
+    static void freeDirectBuffer(char* buf);
+
 protected:
     bool doRestore;
     QString backupSuffix;
+    bool direct;
+    QString directFileName;
+    qint64 cacheDropPos;
     virtual bool throwError();
-    virtual QString getErrDataStr();
+    virtual ErrorManager::ErrorData getErrData();
 };
 
 class QSaveFileEx: public QIODeviceHelper<QSaveFile> {
@@ -558,7 +836,59 @@ public:
     QSaveFileEx(const QString& filename, QObject *parent = nullptr);
     ~QSaveFileEx();
     virtual bool throwError();
-    virtual QString getErrDataStr();
+    virtual ErrorManager::ErrorData getErrData();
+};
+
+// Incremental saves for large documents:
+// save() appends only the changed regions to "<filename>.journal",
+// load() reads the base file and replays every fully written save from the journal.
+// When the journal grows past compactThreshold() the whole content is committed
+// to the base file through QSaveFileEx and the journal starts over.
+class QSaveFileJournal {
+    Q_GADGET
+
+public:
+    enum class Err {
+        readBase = 1,
+        openJournal,
+        writeJournal,
+        commitBase
+    };
+    Q_ENUM(Err)
+
+    struct Region {
+        qint64 offset;
+        qint64 size;
+    };
+
+    static const qint64 defaultCompactThreshold = 64 * 1024 * 1024;
+
+    explicit QSaveFileJournal(const QString& filename);
+    ~QSaveFileJournal();
+    QSaveFileJournal(const QSaveFileJournal&) = delete;
+
+    bool load(QByteArray& content);
+    bool save(const QByteArray& content, const QVector<Region>& changed);
+    bool compact(const QByteArray& content);
+
+    inline void setCompactThreshold(qint64 bytes){threshold = bytes;}
+    inline qint64 compactThreshold() const {return threshold;}
+    inline qint64 journalSize() const {return journal.isOpen() ? journal.size() : 0;}
+    inline const QString& fileName() const {return filename;}
+    inline QString journalFileName() const {return filename + QStringLiteral(".journal");}
+
+    static QString errorCodeToString(Err errorCode);
+
+protected:
+    QString filename;
+    qint64 threshold;
+    QIODeviceHelper<QFile> journal;
+
+    bool openJournal(QByteArray* content = nullptr);
+    bool syncJournal();
+    bool replayJournal(QByteArray* content);
+    QByteArray journalHeader() const;
+    static QByteArray recordHeader(char type, qint64 a, qint64 b, const char* data, qint64 size);
 };
 
 class QProcessEx: public QIODeviceHelper<QProcess>{};
@@ -0,0 +1,535 @@
+/****************************************************************************}
+{ sharedring.cpp - shared memory transport between local processes           }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#include "sharedring.h"
+#include <atomic>
+#include <limits>
+
+#ifdef Q_OS_LINUX
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/eventfd.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// head and tail only grow; the position in the ring is the value modulo the ring size
+struct QSharedRingEx::Ring {
+    alignas(64) std::atomic<quint64> head;
+    alignas(64) std::atomic<quint64> tail;
+    alignas(64) std::atomic<quint32> producerClosed;
+    std::atomic<quint32> consumerClosed;
+};
+
+static_assert(std::atomic<quint64>::is_always_lock_free, "64-bit atomics must be lock-free to be shared between processes");
+
+namespace {
+    struct Handshake {
+        quint32 magic;
+        quint32 version;
+        quint64 ringSize;
+    };
+
+    const quint32 handshakeMagic = 0x47525351; // "QSRG"
+    const quint32 handshakeVersion = 2;
+    const qint64 headerSize = 4096;
+}
+
+QSharedRingEx::QSharedRingEx(QObject *parent): QIODeviceHelper<QIODevice>(parent)
+  ,memFd(-1)
+  ,dataEvent(-1)
+  ,spaceEvent(-1)
+  ,peerDataEvent(-1)
+  ,peerSpaceEvent(-1)
+  ,socketFd(-1)
+  ,mem(nullptr)
+  ,memSize(0)
+  ,ringSz(0)
+  ,inRing(nullptr)
+  ,outRing(nullptr)
+  ,inData(nullptr)
+  ,outData(nullptr)
+  ,dataNotifier(nullptr)
+  ,spaceNotifier(nullptr)
+  ,peerGone(false)
+{
+}
+
+QSharedRingEx::~QSharedRingEx()
+{
+    close();
+}
+
+bool QSharedRingEx::create(QLocalSocket *socket, qint64 ringSize)
+{
+#ifdef Q_OS_LINUX
+    if(isOpen())
+        return false;
+
+    qint64 size = 4096;
+    ringSize = qMin(ringSize, maxRingSize);
+    while(size < ringSize)
+        size *= 2;
+
+    int fd = ::memfd_create("QSharedRingEx", MFD_CLOEXEC);
+    CHECK(fd != -1, QSharedRingErr::Err::createMemory, qt_error_string(errno));
+    // the memory, then "data" and "space" events of the creator, then the same for the attacher
+    int fds[5] = {fd, -1, -1, -1, -1};
+    bool ok = ::ftruncate(fd, headerSize + size * 2) != -1;
+    for(int a=1; ok && a<5; a++)
+    {
+        fds[a] = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        ok = fds[a] != -1;
+    }
+    if(!ok)
+    {
+        SETERROR(QSharedRingErr::Err::createMemory, qt_error_string(errno));
+        for(int a=0; a<5; a++)
+        {
+            if(fds[a] != -1)
+                ::close(fds[a]);
+        }
+        return false;
+    }
+
+    if(!setup(fd, {fds[1], fds[2], fds[3], fds[4]}, socket, size, true))
+        return false;
+
+    Handshake hs {handshakeMagic, handshakeVersion, static_cast<quint64>(size)};
+    iovec iov {&hs, sizeof(hs)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    forever
+    {
+        ssize_t n = ::sendmsg(static_cast<int>(socket->socketDescriptor()), &msg, MSG_NOSIGNAL);
+        if(n == sizeof(hs))
+            return true;
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            pollfd p {static_cast<int>(socket->socketDescriptor()), POLLOUT, 0};
+            if(::poll(&p, 1, -1) >= 0 || errno == EINTR)
+                continue;
+        }
+        SETERROR(QSharedRingErr::Err::sendHandshake, qt_error_string(errno));
+        close();
+        return false;
+    }
+#else
+    Q_UNUSED(socket);
+    Q_UNUSED(ringSize);
+    SETERROR(QSharedRingErr::Err::unsupported);
+    return false;
+#endif
+}
+
+bool QSharedRingEx::attach(QLocalSocket *socket, int msecs)
+{
+#ifdef Q_OS_LINUX
+    if(isOpen())
+        return false;
+
+    int sock = static_cast<int>(socket->socketDescriptor());
+    pollfd p {sock, POLLIN, 0};
+    int res;
+    do
+    {
+        res = ::poll(&p, 1, msecs);
+    }
+    while(res == -1 && errno == EINTR);
+    CHECK(res == 1, QSharedRingErr::Err::receiveHandshake, res ? qt_error_string(errno) : QStringLiteral("timeout"));
+
+    Handshake hs {};
+    iovec iov {&hs, sizeof(hs)};
+    int fds[5] = {-1, -1, -1, -1, -1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do
+    {
+        n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    }
+    while(n == -1 && errno == EINTR);
+    CHECK(n != -1, QSharedRingErr::Err::receiveHandshake, qt_error_string(errno));
+
+    int nFds = 0;
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+        nFds = static_cast<int>((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * static_cast<size_t>(qMin(nFds, 5)));
+    }
+    // the memory is only mapped if it's really as big as the peer says, otherwise the first access is a SIGBUS
+    struct stat st {};
+    if(n != sizeof(hs) || nFds != 5 || (msg.msg_flags & MSG_CTRUNC)
+            || hs.magic != handshakeMagic || hs.version != handshakeVersion
+            || !hs.ringSize || (hs.ringSize & (hs.ringSize - 1)) || hs.ringSize > static_cast<quint64>(maxRingSize)
+            || ::fstat(fds[0], &st) == -1 || st.st_size != static_cast<off_t>(headerSize + static_cast<qint64>(hs.ringSize) * 2))
+    {
+        for(int a=0; a<qMin(nFds, 5); a++)
+            ::close(fds[a]);
+        SETERROR(QSharedRingErr::Err::badHandshake);
+        return false;
+    }
+
+    return setup(fds[0], {fds[3], fds[4], fds[1], fds[2]}, socket, static_cast<qint64>(hs.ringSize), false);
+#else
+    Q_UNUSED(socket);
+    Q_UNUSED(msecs);
+    SETERROR(QSharedRingErr::Err::unsupported);
+    return false;
+#endif
+}
+
+qint64 QSharedRingEx::bytesAvailable() const
+{
+    qint64 n = QIODeviceHelper<QIODevice>::bytesAvailable();
+    if(inRing)
+        n += static_cast<qint64>(inRing->head.load(std::memory_order_acquire) - inRing->tail.load(std::memory_order_relaxed));
+    return n;
+}
+
+void QSharedRingEx::close()
+{
+    if(!isOpen())
+        return;
+    flushPending();
+    pending.clear();
+    outRing->producerClosed.store(1);
+    inRing->consumerClosed.store(1);
+    signalEvent(peerDataEvent);
+    signalEvent(peerSpaceEvent);
+    QIODeviceHelper<QIODevice>::close();
+    release();
+}
+
+bool QSharedRingEx::waitForReadyRead(int msecs)
+{
+    if(!isOpen())
+        return false;
+    QElapsedTimer timer;
+    timer.start();
+    forever
+    {
+        if(bytesAvailable())
+            return true;
+        if(isPeerFinished())
+            return false;
+        int remaining = msecs < 0 ? -1 : static_cast<int>(qMax<qint64>(0, msecs - timer.elapsed()));
+        if(!waitForEvent(remaining, true))
+            return bytesAvailable() > 0;
+    }
+}
+
+bool QSharedRingEx::waitForBytesWritten(int msecs)
+{
+    if(!isOpen())
+        return false;
+    QElapsedTimer timer;
+    timer.start();
+    forever
+    {
+        if(!flushPending())
+            return false;
+        if(pending.isEmpty())
+            return true;
+        int remaining = msecs < 0 ? -1 : static_cast<int>(qMax<qint64>(0, msecs - timer.elapsed()));
+        if(!waitForEvent(remaining, false))
+            return flushPending() && pending.isEmpty();
+    }
+}
+
+QString QSharedRingEx::errorCodeToString(QSharedRingErr::Err errorCode)
+{
+    switch(errorCode)
+    {
+        case QSharedRingErr::Err::unsupported: return QStringLiteral("Shared memory rings are not supported on this platform");
+        case QSharedRingErr::Err::createMemory: return QStringLiteral("Cannot create the shared memory");
+        case QSharedRingErr::Err::sendHandshake: return QStringLiteral("Cannot send the descriptors to the peer");
+        case QSharedRingErr::Err::receiveHandshake: return QStringLiteral("Cannot receive the descriptors from the peer");
+        case QSharedRingErr::Err::badHandshake: return QStringLiteral("Invalid handshake");
+    }
+    return QString();
+}
+
+bool QSharedRingEx::setup(int memFd, const int (&events)[4], QLocalSocket *socket, qint64 ringSize, bool creator)
+{
+#ifdef Q_OS_LINUX
+    this->memFd = memFd;
+    dataEvent = events[0];
+    spaceEvent = events[1];
+    peerDataEvent = events[2];
+    peerSpaceEvent = events[3];
+    ringSz = ringSize;
+    memSize = headerSize + ringSize * 2;
+    // a duplicate stays valid (and reports the hangup) even after QLocalSocket closes its descriptor
+    socketFd = ::fcntl(static_cast<int>(socket->socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+
+    void* p = ::mmap(nullptr, static_cast<size_t>(memSize), PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    if(p == MAP_FAILED || socketFd == -1)
+    {
+        SETERROR(QSharedRingErr::Err::createMemory, qt_error_string(errno));
+        if(p != MAP_FAILED)
+            ::munmap(p, static_cast<size_t>(memSize));
+        release();
+        return false;
+    }
+    mem = static_cast<char*>(p);
+
+    // ring 0 goes from the creator to the attacher, ring 1 goes back
+    Ring* rings = reinterpret_cast<Ring*>(mem);
+    static_assert(sizeof(Ring) * 2 <= headerSize, "ring headers don't fit");
+    if(creator)
+    {
+        new (&rings[0]) Ring {{0}, {0}, {0}, {0}};
+        new (&rings[1]) Ring {{0}, {0}, {0}, {0}};
+    }
+    outRing = &rings[creator ? 0 : 1];
+    inRing = &rings[creator ? 1 : 0];
+    outData = mem + headerSize + (creator ? 0 : ringSize);
+    inData = mem + headerSize + (creator ? ringSize : 0);
+    peerGone = false;
+    pending.clear();
+
+    dataNotifier = new QSocketNotifier(dataEvent, QSocketNotifier::Read, this);
+    QObject::connect(dataNotifier, &QSocketNotifier::activated, this, [this]{onData();});
+    spaceNotifier = new QSocketNotifier(spaceEvent, QSocketNotifier::Read, this);
+    QObject::connect(spaceNotifier, &QSocketNotifier::activated, this, [this]{onSpace();});
+    QObject::connect(socket, &QLocalSocket::disconnected, this, [this]{
+        peerGone = true;
+        emit readChannelFinished();
+    });
+
+    QIODeviceHelper<QIODevice>::open(ReadWrite | Unbuffered);
+    return true;
+#else
+    Q_UNUSED(memFd);
+    Q_UNUSED(events);
+    Q_UNUSED(socket);
+    Q_UNUSED(ringSize);
+    Q_UNUSED(creator);
+    return false;
+#endif
+}
+
+void QSharedRingEx::release()
+{
+#ifdef Q_OS_LINUX
+    delete dataNotifier;
+    dataNotifier = nullptr;
+    delete spaceNotifier;
+    spaceNotifier = nullptr;
+    if(mem)
+        ::munmap(mem, static_cast<size_t>(memSize));
+    mem = nullptr;
+    inRing = nullptr;
+    outRing = nullptr;
+    inData = nullptr;
+    outData = nullptr;
+    for(int* fd : {&memFd, &dataEvent, &spaceEvent, &peerDataEvent, &peerSpaceEvent, &socketFd})
+    {
+        if(*fd != -1)
+            ::close(*fd);
+        *fd = -1;
+    }
+#endif
+}
+
+bool QSharedRingEx::waitForEvent(int msecs, bool forData)
+{
+#ifdef Q_OS_LINUX
+    // a reader also moves its own pending writes along, otherwise two peers
+    // waiting for each other's replies with full rings would never wake up;
+    // a writer doesn't touch the data event so readyRead() isn't lost
+    pollfd p[3] = {
+        {socketFd, POLLRDHUP, 0},
+        {spaceEvent, POLLIN, 0},
+        {dataEvent, POLLIN, 0}
+    };
+    nfds_t nFds = forData ? 3 : 2;
+    if(forData && pending.isEmpty())
+        p[1].fd = -1;
+    int res;
+    do
+    {
+        res = ::poll(p, nFds, msecs);
+    }
+    while(res == -1 && errno == EINTR);
+    if(res <= 0)
+        return false;
+    // the socket may still be used for other messages, only a hangup matters here
+    if(p[0].revents)
+        peerGone = true;
+    if(p[1].revents & POLLIN)
+    {
+        clearEvent(spaceEvent);
+        flushPending();
+    }
+    if(p[2].revents & POLLIN)
+        clearEvent(dataEvent);
+    return !peerGone || (p[2].revents & POLLIN);
+#else
+    Q_UNUSED(msecs);
+    Q_UNUSED(forData);
+    return false;
+#endif
+}
+
+void QSharedRingEx::clearEvent(int fd)
+{
+#ifdef Q_OS_LINUX
+    quint64 cnt;
+    while(::read(fd, &cnt, sizeof(cnt)) == -1 && errno == EINTR){}
+#else
+    Q_UNUSED(fd);
+#endif
+}
+
+void QSharedRingEx::signalEvent(int fd)
+{
+#ifdef Q_OS_LINUX
+    quint64 one = 1;
+    while(::write(fd, &one, sizeof(one)) == -1 && errno == EINTR){}
+#else
+    Q_UNUSED(fd);
+#endif
+}
+
+void QSharedRingEx::onData()
+{
+    clearEvent(dataEvent);
+    if(inRing->head.load(std::memory_order_acquire) != inRing->tail.load(std::memory_order_relaxed))
+        emit readyRead();
+    else if(inRing->producerClosed.load())
+        emit readChannelFinished();
+}
+
+void QSharedRingEx::onSpace()
+{
+    clearEvent(spaceEvent);
+    flushPending();
+}
+
+bool QSharedRingEx::isPeerFinished() const
+{
+    return peerGone || inRing->producerClosed.load();
+}
+
+bool QSharedRingEx::isPeerClosed() const
+{
+    return peerGone || outRing->consumerClosed.load();
+}
+
+qint64 QSharedRingEx::readData(char *data, qint64 maxSize)
+{
+    if(!inRing)
+        return -1;
+
+    quint64 tail = inRing->tail.load(std::memory_order_relaxed);
+    quint64 head = inRing->head.load(std::memory_order_acquire);
+    qint64 n = qMin(maxSize, static_cast<qint64>(head - tail));
+    if(n <= 0)
+        return isPeerFinished() ? -1 : 0;
+
+    qint64 off = static_cast<qint64>(tail & static_cast<quint64>(ringSz - 1));
+    qint64 first = qMin(n, ringSz - off);
+    memcpy(data, inData + off, static_cast<size_t>(first));
+    memcpy(data + first, inData, static_cast<size_t>(n - first));
+
+    // the writer sleeps only on a full ring; the seq_cst pair here and in writeToRing()
+    // guarantees that either it sees the new tail or this side sees that it was full
+    inRing->tail.store(tail + static_cast<quint64>(n));
+    if(inRing->head.load() - tail == static_cast<quint64>(ringSz))
+        signalEvent(peerSpaceEvent);
+    return n;
+}
+
+qint64 QSharedRingEx::writeData(const char *data, qint64 maxSize)
+{
+    if(!outRing)
+        return -1;
+    if(isPeerClosed())
+    {
+        setErrorString(QStringLiteral("The peer has closed the connection"));
+        return -1;
+    }
+
+    // keep the order: nothing goes to the ring directly while older data is waiting
+    qint64 n = pending.isEmpty() ? writeToRing(data, maxSize) : 0;
+    // QByteArray can't grow forever, the caller gets a partial count then
+    qint64 keep = qMin(maxSize - n, std::numeric_limits<int>::max() / 2 - static_cast<qint64>(pending.size()));
+    if(keep > 0)
+    {
+        pending.append(data + n, static_cast<int>(keep));
+        n += keep;
+    }
+    return n;
+}
+
+qint64 QSharedRingEx::writeToRing(const char *data, qint64 maxSize)
+{
+    quint64 head = outRing->head.load(std::memory_order_relaxed);
+    quint64 tail = outRing->tail.load();
+    qint64 n = qMin(ringSz - static_cast<qint64>(head - tail), maxSize);
+    if(n <= 0)
+        return 0;
+
+    qint64 off = static_cast<qint64>(head & static_cast<quint64>(ringSz - 1));
+    qint64 first = qMin(n, ringSz - off);
+    memcpy(outData + off, data, static_cast<size_t>(first));
+    memcpy(outData, data + first, static_cast<size_t>(n - first));
+
+    // the reader sleeps only on an empty ring, see readData()
+    outRing->head.store(head + static_cast<quint64>(n));
+    if(outRing->tail.load() == head)
+        signalEvent(peerDataEvent);
+    return n;
+}
+
+bool QSharedRingEx::flushPending()
+{
+    if(!outRing)
+        return false;
+    if(pending.isEmpty())
+        return true;
+    if(isPeerClosed())
+    {
+        setErrorString(QStringLiteral("The peer has closed the connection"));
+        pending.clear();
+        return false;
+    }
+    qint64 n = writeToRing(pending.constData(), pending.size());
+    if(n)
+        pending.remove(0, static_cast<int>(n));
+    return true;
+}
@@ -0,0 +1,105 @@
+/****************************************************************************}
+{ sharedring.h - shared memory transport between local processes             }
+{                                                                            }
+{ Copyright (c) 2026 Alexey Parfenov <zxed@alkatrazstudio.net>               }
+{                                                                            }
+{ This library is free software: you can redistribute it and/or modify it    }
+{ under the terms of the GNU General Public License as published by          }
+{ the Free Software Foundation, either version 3 of the License,             }
+{ or (at your option) any later version.                                     }
+{                                                                            }
+{ This library is distributed in the hope that it will be useful,            }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of             }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU           }
+{ General Public License for more details: https://gnu.org/licenses/gpl.html }
+{****************************************************************************/
+
+#pragma once
+
+#include "qiodevicehelper.h"
+#include <QLocalSocket>
+
+namespace QSharedRingErr {
+    Q_NAMESPACE
+
+    enum class Err {
+        unsupported = 1,
+        createMemory,
+        sendHandshake,
+        receiveHandshake,
+        badHandshake
+    };
+    Q_ENUM_NS(Err)
+}
+
+// A byte stream between two local processes that goes through a pair of ring buffers
+// in shared memory (memfd) instead of the kernel; eventfds are used for wakeups
+// (one for "data arrived" and one for "space freed" per direction).
+// The descriptors are passed once over an already connected QLocalSocket:
+// one side calls create(), the other one calls attach().
+// After that the socket is only watched for a hangup and can still be used for anything else.
+// attach() must be called before the socket gets a chance to read anything,
+// i.e. right after connecting, without returning to the event loop.
+// Reading behaves like a socket: readyRead() is emitted from the event loop
+// and waitForReadyRead() blocks. Writing never blocks: whatever doesn't fit into the peer's ring
+// is kept in memory and moved there from the event loop (or by waitForBytesWritten())
+// as the peer reads. close() doesn't wait for that, call waitForBytesWritten() before it.
+// Linux only.
+class QSharedRingEx: public QIODeviceHelper<QIODevice> {
+public:
+    static const qint64 defaultRingSize = 16 * 1024 * 1024;
+    static const qint64 maxRingSize = 1024 * 1024 * 1024;
+
+    QSharedRingEx(QObject* parent = nullptr);
+    ~QSharedRingEx();
+
+    bool create(QLocalSocket* socket, qint64 ringSize = defaultRingSize);
+    bool attach(QLocalSocket* socket, int msecs = 30000);
+
+    virtual bool isSequential() const {return true;}
+    virtual qint64 bytesAvailable() const;
+    virtual qint64 bytesToWrite() const {return pending.size();}
+    virtual void close();
+    virtual bool waitForReadyRead(int msecs);
+    virtual bool waitForBytesWritten(int msecs);
+
+    inline qint64 ringSize() const {return ringSz;}
+
+    static QString errorCodeToString(QSharedRingErr::Err errorCode);
+
+protected:
+    struct Ring;
+
+    int memFd;
+    int dataEvent;
+    int spaceEvent;
+    int peerDataEvent;
+    int peerSpaceEvent;
+    int socketFd;
+    char* mem;
+    qint64 memSize;
+    qint64 ringSz;
+    Ring* inRing;
+    Ring* outRing;
+    char* inData;
+    char* outData;
+    QSocketNotifier* dataNotifier;
+    QSocketNotifier* spaceNotifier;
+    QByteArray pending;
+    bool peerGone;
+
+    bool setup(int memFd, const int (&events)[4], QLocalSocket* socket, qint64 ringSize, bool creator);
+    void release();
+    bool waitForEvent(int msecs, bool forData);
+    static void clearEvent(int fd);
+    static void signalEvent(int fd);
+    void onData();
+    void onSpace();
+    bool isPeerFinished() const;
+    bool isPeerClosed() const;
+    qint64 writeToRing(const char* data, qint64 maxSize);
+    bool flushPending();
+
+    virtual qint64 readData(char* data, qint64 maxSize);
+    virtual qint64 writeData(const char* data, qint64 maxSize);
+};
@@ -25,228 +25,2707 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #include "simplecrypt.h"
+#include "fasthash.h"
 #include <QByteArray>
 #include <QtDebug>
 #include <QtGlobal>
 #include <QDateTime>
 #include <QCryptographicHash>
 #include <QDataStream>
+#include <QTemporaryFile>
+#include <QtEndian>
+#include <QtConcurrent>
+#include <QThread>
+#include <atomic>
+#include <climits>
+#include <zlib.h>
+#include <cmath>
+#include <functional>
+#include <utility>
+
+#ifdef SIMPLECRYPT_ZSTD
+    #include <zstd.h>
+#endif
+#ifdef SIMPLECRYPT_LZ4
+    #include <lz4frame.h>
+#endif
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    #include <QRandomGenerator>
+#endif
+#ifdef Q_OS_LINUX
+    #include <sys/random.h>
+#endif
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define SIMPLECRYPT_AVX2
+#endif
+
+/*
+  The cypher is c[i] = p[i] ^ k[i % 8] ^ c[i - 1].
+  Decryption only depends on the cyphertext, so it's done a whole vector at a time.
+  Encryption is a prefix XOR of p[i] ^ k[i % 8], done with log-step shifts inside a vector
+  and a broadcast of the previous vector's last byte.
+  Any block length that is a multiple of 8 keeps the key phase, so the key is a broadcast 64-bit word.
+  */
+namespace {
+    const quint64 byteBroadcast = 0x0101010101010101ULL;
+
+    inline quint64 keyWord(const char* key, qint64 pos)
+    {
+        quint64 k = qFromLittleEndian<quint64>(key);
+        int shift = int(pos % 8) * 8;
+        return shift ? (k >> shift) | (k << (64 - shift)) : k;
+    }
+
+    void encryptWords(char* data, qint64 len, const char* key, qint64 pos, char& lastChar)
+    {
+        quint64 kw = keyWord(key, pos);
+        quint64 carry = uchar(lastChar) * byteBroadcast;
+        qint64 i = 0;
+        for (; i + 8 <= len; i += 8) {
+            quint64 w = qFromLittleEndian<quint64>(data + i) ^ kw;
+            w ^= w << 8;
+            w ^= w << 16;
+            w ^= w << 32;
+            w ^= carry;
+            qToLittleEndian(w, data + i);
+            carry = (w >> 56) * byteBroadcast;
+        }
+        lastChar = char(carry);
+        for (; i < len; i++) {
+            data[i] = data[i] ^ key[(pos + i) % 8] ^ lastChar;
+            lastChar = data[i];
+        }
+    }
+
+    void decryptWords(char* data, qint64 len, const char* key, qint64 pos, char& lastChar)
+    {
+        quint64 kw = keyWord(key, pos);
+        qint64 i = 0;
+        for (; i + 8 <= len; i += 8) {
+            quint64 w = qFromLittleEndian<quint64>(data + i);
+            qToLittleEndian(w ^ ((w << 8) | uchar(lastChar)) ^ kw, data + i);
+            lastChar = char(w >> 56);
+        }
+        for (; i < len; i++) {
+            char currentChar = data[i];
+            data[i] = currentChar ^ lastChar ^ key[(pos + i) % 8];
+            lastChar = currentChar;
+        }
+    }
+
+#ifdef __SSE2__
+    void encryptSse2(char* data, qint64 len, const char* key, qint64 pos, char& lastChar)
+    {
+        const __m128i kv = _mm_set1_epi64x(qint64(keyWord(key, pos)));
+        __m128i carry = _mm_set1_epi8(lastChar);
+        qint64 i = 0;
+        for (; i + 16 <= len; i += 16) {
+            __m128i* p = reinterpret_cast<__m128i*>(data + i);
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(p), kv);
+            v = _mm_xor_si128(v, _mm_slli_si128(v, 1));
+            v = _mm_xor_si128(v, _mm_slli_si128(v, 2));
+            v = _mm_xor_si128(v, _mm_slli_si128(v, 4));
+            v = _mm_xor_si128(v, _mm_slli_si128(v, 8));
+            v = _mm_xor_si128(v, carry);
+            _mm_storeu_si128(p, v);
+            __m128i t = _mm_shufflehi_epi16(_mm_unpackhi_epi8(v, v), 0xFF);
+            carry = _mm_unpackhi_epi64(t, t);
+        }
+        lastChar = char(_mm_cvtsi128_si32(carry));
+        encryptWords(data + i, len - i, key, pos + i, lastChar);
+    }
+
+    void decryptSse2(char* data, qint64 len, const char* key, qint64 pos, char& lastChar)
+    {
+        const __m128i kv = _mm_set1_epi64x(qint64(keyWord(key, pos)));
+        qint64 i = 0;
+        for (; i + 16 <= len; i += 16) {
+            __m128i* p = reinterpret_cast<__m128i*>(data + i);
+            __m128i v = _mm_loadu_si128(p);
+            __m128i prev = _mm_or_si128(_mm_slli_si128(v, 1), _mm_cvtsi32_si128(uchar(lastChar)));
+            lastChar = char(_mm_extract_epi16(v, 7) >> 8);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_xor_si128(v, prev), kv));
+        }
+        decryptWords(data + i, len - i, key, pos + i, lastChar);
+    }
+#endif
+
+#ifdef SIMPLECRYPT_AVX2
+    __attribute__((target("avx2")))
+    void encryptAvx2(char* data, qint64 len, const char* key, qint64 pos, char& lastChar)
+    {
+        const __m256i kv = _mm256_set1_epi64x(qint64(keyWord(key, pos)));
+        const __m256i byte15 = _mm256_set1_epi8(15);
+        __m256i carry = _mm256_set1_epi8(lastChar);
+        qint64 i = 0;
+        for (; i + 32 <= len; i += 32) {
+            __m256i* p = reinterpret_cast<__m256i*>(data + i);
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(p), kv);
+            v = _mm256_xor_si256(v, _mm256_slli_si256(v, 1));
+            v = _mm256_xor_si256(v, _mm256_slli_si256(v, 2));
+            v = _mm256_xor_si256(v, _mm256_slli_si256(v, 4));
+            v = _mm256_xor_si256(v, _mm256_slli_si256(v, 8));
+            // the shifts above stay within 128-bit lanes: carry the low lane into the high one
+            v = _mm256_xor_si256(v, _mm256_shuffle_epi8(_mm256_permute2x128_si256(v, v, 0x08), byte15));
+            v = _mm256_xor_si256(v, carry);
+            _mm256_storeu_si256(p, v);
+            carry = _mm256_shuffle_epi8(_mm256_permute2x128_si256(v, v, 0x11), byte15);
+        }
+        lastChar = char(_mm256_extract_epi8(carry, 0));
+        encryptWords(data + i, len - i, key, pos + i, lastChar);
+    }
+
+    __attribute__((target("avx2")))
+    void decryptAvx2(char* data, qint64 len, const char* key, qint64 pos, char& lastChar)
+    {
+        const __m256i kv = _mm256_set1_epi64x(qint64(keyWord(key, pos)));
+        qint64 i = 0;
+        for (; i + 32 <= len; i += 32) {
+            __m256i* p = reinterpret_cast<__m256i*>(data + i);
+            __m256i v = _mm256_loadu_si256(p);
+            __m256i prev = _mm256_alignr_epi8(v, _mm256_permute2x128_si256(v, v, 0x08), 15);
+            prev = _mm256_or_si256(prev, _mm256_set_epi64x(0, 0, 0, uchar(lastChar)));
+            lastChar = char(_mm256_extract_epi8(v, 31));
+            _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_xor_si256(v, prev), kv));
+        }
+        decryptWords(data + i, len - i, key, pos + i, lastChar);
+    }
+
+    bool hasAvx2()
+    {
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+    }
+#endif
+
+    // pos is the offset of data in the encrypted stream, lastChar is the cyphertext byte before it
+    void encryptChain(char* data, qint64 len, const char* key, qint64 pos, char& lastChar)
+    {
+#ifdef SIMPLECRYPT_AVX2
+        if (hasAvx2()) {
+            encryptAvx2(data, len, key, pos, lastChar);
+            return;
+        }
+#endif
+#ifdef __SSE2__
+        encryptSse2(data, len, key, pos, lastChar);
+#else
+        encryptWords(data, len, key, pos, lastChar);
+#endif
+    }
+
+    void decryptChain(char* data, qint64 len, const char* key, qint64 pos, char& lastChar)
+    {
+#ifdef SIMPLECRYPT_AVX2
+        if (hasAvx2()) {
+            decryptAvx2(data, len, key, pos, lastChar);
+            return;
+        }
+#endif
+#ifdef __SSE2__
+        decryptSse2(data, len, key, pos, lastChar);
+#else
+        decryptWords(data, len, key, pos, lastChar);
+#endif
+    }
+
+    /*
+      Base64 straight between the binary cyphertext and the UTF-16 storage of a QString.
+      The output is the same as the one of toBase64(); the decoder is as lenient as fromBase64():
+      any character outside of the alphabet (padding included) is skipped.
+      The vector paths (Muła's algorithm) only handle runs of valid characters, anything else is left to the scalar code.
+      */
+    const char base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    inline qint64 base64EncodedSize(qint64 len)
+    {
+        return (len + 2) / 3 * 4;
+    }
+
+    inline qint64 base64DecodedMaxSize(qint64 len)
+    {
+        return len * 3 / 4;
+    }
+
+    void base64EncodeScalar(const char* data, qint64 len, ushort* out)
+    {
+        const uchar* p = reinterpret_cast<const uchar*>(data);
+        qint64 i = 0;
+        for (; i + 3 <= len; i += 3) {
+            uint v = (uint(p[i]) << 16) | (uint(p[i + 1]) << 8) | p[i + 2];
+            *out++ = ushort(base64Alphabet[v >> 18]);
+            *out++ = ushort(base64Alphabet[(v >> 12) & 0x3f]);
+            *out++ = ushort(base64Alphabet[(v >> 6) & 0x3f]);
+            *out++ = ushort(base64Alphabet[v & 0x3f]);
+        }
+        if (i < len) {
+            uint v = uint(p[i]) << 16;
+            if (i + 1 < len)
+                v |= uint(p[i + 1]) << 8;
+            *out++ = ushort(base64Alphabet[v >> 18]);
+            *out++ = ushort(base64Alphabet[(v >> 12) & 0x3f]);
+            *out++ = i + 1 < len ? ushort(base64Alphabet[(v >> 6) & 0x3f]) : ushort('=');
+            *out++ = ushort('=');
+        }
+    }
+
+    qint64 base64DecodeScalar(const ushort* in, qint64 len, char* out)
+    {
+        uint buf = 0;
+        int nbits = 0;
+        qint64 n = 0;
+        for (qint64 i = 0; i < len; i++) {
+            ushort ch = in[i];
+            int d;
+            if (ch >= 'A' && ch <= 'Z')
+                d = ch - 'A';
+            else if (ch >= 'a' && ch <= 'z')
+                d = ch - 'a' + 26;
+            else if (ch >= '0' && ch <= '9')
+                d = ch - '0' + 52;
+            else if (ch == '+')
+                d = 62;
+            else if (ch == '/')
+                d = 63;
+            else
+                continue;
+            buf = (buf << 6) | uint(d);
+            nbits += 6;
+            if (nbits >= 8) {
+                nbits -= 8;
+                out[n++] = char(buf >> nbits);
+                buf &= (1u << nbits) - 1;
+            }
+        }
+        return n;
+    }
+
+#ifdef SIMPLECRYPT_AVX2
+    bool hasSsse3()
+    {
+        static const bool ssse3 = __builtin_cpu_supports("ssse3");
+        return ssse3;
+    }
+
+    // [a b c] -> [b a c b] in every 32-bit word, then 6-bit indexes in every byte
+    __attribute__((target("ssse3")))
+    inline __m128i base64Indexes(__m128i v)
+    {
+        v = _mm_shuffle_epi8(v, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+        __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(t0, t1);
+    }
+
+    __attribute__((target("ssse3")))
+    inline __m128i base64Chars(__m128i idx)
+    {
+        const __m128i offsets = _mm_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+        return _mm_add_epi8(idx, _mm_shuffle_epi8(offsets, r));
+    }
+
+    // returns the number of bytes encoded
+    __attribute__((target("ssse3")))
+    qint64 base64EncodeSsse3(const char* data, qint64 len, ushort* out)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        qint64 i = 0;
+        for (; i + 16 <= len; i += 12) {
+            __m128i c = base64Chars(base64Indexes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i))));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(c, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(c, zero));
+            out += 16;
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    qint64 base64EncodeAvx2(const char* data, qint64 len, ushort* out)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+        const __m256i offsets = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        qint64 i = 0;
+        for (; i + 28 <= len; i += 24) {
+            __m256i v = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i))),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 12)), 1);
+            v = _mm256_shuffle_epi8(v, shuffle);
+            __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+            __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+            __m256i idx = _mm256_or_si256(t0, t1);
+            __m256i r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+            r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+            __m256i c = _mm256_add_epi8(idx, _mm256_shuffle_epi8(offsets, r));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(c)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(c, 1)));
+            out += 32;
+        }
+        return i + base64EncodeSsse3(data + i, len - i, out);
+    }
+
+    // 16 characters (UTF-16 code units above 0xFF saturate to an invalid 0xFF) to 6-bit values;
+    // false if any of them is not in the alphabet
+    __attribute__((target("ssse3")))
+    inline bool base64Values(__m128i c, __m128i& values)
+    {
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), c));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), c));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+        __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+        __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+        if (_mm_movemask_epi8(valid) != 0xFFFF)
+            return false;
+        __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+        shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+        shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+        shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+        shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+        values = _mm_add_epi8(c, shift);
+        return true;
+    }
+
+    // returns the number of characters decoded; it writes 16 bytes per 12 decoded ones
+    __attribute__((target("ssse3")))
+    qint64 base64DecodeSsse3(const ushort* in, qint64 len, char* out)
+    {
+        const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        qint64 i = 0;
+        for (; i + 32 <= len; i += 16) {
+            __m128i c = _mm_packus_epi16(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8)));
+            __m128i v;
+            if (!base64Values(c, v))
+                break;
+            v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+            v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(v, pack));
+            out += 12;
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    qint64 base64DecodeAvx2(const ushort* in, qint64 len, char* out)
+    {
+        const __m256i pack = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        qint64 i = 0;
+        for (; i + 64 <= len; i += 32) {
+            __m256i c = _mm256_packus_epi16(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16)));
+            c = _mm256_permute4x64_epi64(c, 0xD8);
+            __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+            __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+            __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+            __m256i plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+            __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+            __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+            if (_mm256_movemask_epi8(valid) != -1)
+                break;
+            __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')));
+            __m256i v = _mm256_add_epi8(c, shift);
+            v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+            v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+            v = _mm256_shuffle_epi8(v, pack);
+            v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+            out += 24;
+        }
+        return i + base64DecodeSsse3(in + i, len - i, out);
+    }
+#endif
+
+    // out must have base64EncodedSize(len) characters
+    void base64Encode(const char* data, qint64 len, ushort* out)
+    {
+        qint64 i = 0;
+#ifdef SIMPLECRYPT_AVX2
+        if (hasAvx2())
+            i = base64EncodeAvx2(data, len, out);
+        else if (hasSsse3())
+            i = base64EncodeSsse3(data, len, out);
+#endif
+        base64EncodeScalar(data + i, len - i, out + i / 3 * 4);
+    }
+
+    // out must have base64DecodedMaxSize(len) bytes; returns the decoded size
+    qint64 base64Decode(const ushort* in, qint64 len, char* out)
+    {
+        qint64 i = 0;
+#ifdef SIMPLECRYPT_AVX2
+        if (hasAvx2())
+            i = base64DecodeAvx2(in, len, out);
+        else if (hasSsse3())
+            i = base64DecodeSsse3(in, len, out);
+#endif
+        qint64 n = i / 4 * 3;
+        return n + base64DecodeScalar(in + i, len - i, out + n);
+    }
+
+    QString toBase64String(const char* data, qint64 len)
+    {
+        QString s(int(base64EncodedSize(len)), Qt::Uninitialized);
+        base64Encode(data, len, reinterpret_cast<ushort*>(s.data()));
+        return s;
+    }
+
+    QByteArray fromBase64String(const QString& s)
+    {
+        QByteArray ba(int(base64DecodedMaxSize(s.size())), Qt::Uninitialized);
+        ba.resize(int(base64Decode(s.utf16(), s.size(), ba.data())));
+        return ba;
+    }
+
+    const qint64 streamChunkSize = 64 * 1024;
+
+    // incremental qChecksum() (CRC-16/X-25)
+    class Checksum16
+    {
+    public:
+        void add(const char* data, qint64 len)
+        {
+            static const QVector<quint16> table = makeTable();
+            const uchar* p = reinterpret_cast<const uchar*>(data);
+            for (qint64 i = 0; i < len; i++)
+                crc = quint16((crc >> 8) ^ table[(crc ^ p[i]) & 0xff]);
+        }
+        quint16 result() const {return quint16(~crc);}
+
+    private:
+        quint16 crc = 0xffff;
+
+        static QVector<quint16> makeTable()
+        {
+            QVector<quint16> t(256);
+            for (int i = 0; i < 256; i++) {
+                quint16 c = quint16(i);
+                for (int j = 0; j < 8; j++)
+                    c = (c & 1) ? quint16((c >> 1) ^ 0x8408) : quint16(c >> 1);
+                t[i] = c;
+            }
+            return t;
+        }
+    };
+
+    class Integrity
+    {
+    public:
+        // the key is the 8 key parts, only used with CryptoFlagBlake3
+        Integrity(SimpleCrypt::CryptoFlags flags, const char* key) : m_method(method(flags))
+        {
+            // heavy states are constructed only when needed to keep the other modes allocation-free
+            if (m_method == Sha1) {
+                m_hash.reset(new QCryptographicHash(QCryptographicHash::Sha1));
+            } else if (m_method == Blake3) {
+                QByteArray blake3Key = FastHash::blake3(key, 8, false);
+                m_blake3.reset(new FastHash::Blake3(blake3Key.constData()));
+            }
+        }
+
+        static int size(SimpleCrypt::CryptoFlags flags) {return size(method(flags));}
+
+        void add(const char* data, qint64 len)
+        {
+            switch (m_method) {
+            case Checksum: m_checksum.add(data, len); break;
+            case Sha1: m_hash->addData(data, int(len)); break;
+            case Crc32c: m_crc32c = FastHash::crc32c(data, len, m_crc32c); break;
+            case Xxh64: m_xxh64.addData(data, len); break;
+            case Blake3: m_blake3->addData(data, len); break;
+            default: break;
+            }
+        }
+
+        // writes size() bytes
+        void write(char* out) const
+        {
+            QByteArray r;
+            switch (m_method) {
+            case Checksum: qToBigEndian(m_checksum.result(), out); break;
+            case Crc32c: qToBigEndian(m_crc32c, out); break;
+            case Xxh64: qToBigEndian(m_xxh64.result(), out); break;
+            case Sha1: r = m_hash->result(); break;
+            case Blake3: r = m_blake3->result(); break;
+            default: break;
+            }
+            if (!r.isEmpty())
+                memcpy(out, r.constData(), size_t(r.size()));
+        }
+
+        QByteArray result() const
+        {
+            QByteArray r(size(m_method), Qt::Uninitialized);
+            write(r.data());
+            return r;
+        }
+
+        bool matches(const char* stored) const
+        {
+            char buf[maxSize] = {};
+            write(buf);
+            return memcmp(buf, stored, size_t(size(m_method))) == 0;
+        }
+
+        static const int maxSize = FastHash::blake3Size;
+
+    private:
+        enum Method {None, Checksum, Sha1, Crc32c, Xxh64, Blake3};
+
+        Method m_method;
+        Checksum16 m_checksum;
+        quint32 m_crc32c = 0;
+        FastHash::Xxh64 m_xxh64;
+        QScopedPointer<QCryptographicHash> m_hash;
+        QScopedPointer<FastHash::Blake3> m_blake3;
+
+        static Method method(SimpleCrypt::CryptoFlags flags)
+        {
+            if (flags.testFlag(SimpleCrypt::CryptoFlagChecksum))
+                return Checksum;
+            if (flags.testFlag(SimpleCrypt::CryptoFlagHash))
+                return Sha1;
+            switch (int(flags & SimpleCrypt::CryptoFlagIntegrityMask)) {
+            case SimpleCrypt::CryptoFlagCrc32c: return Crc32c;
+            case SimpleCrypt::CryptoFlagXxh64: return Xxh64;
+            case SimpleCrypt::CryptoFlagBlake3: return Blake3;
+            default: return None;
+            }
+        }
+
+        static int size(Method method)
+        {
+            switch (method) {
+            case Checksum: return 2;
+            case Sha1: return 20;
+            case Crc32c: return 4;
+            case Xxh64: return 8;
+            case Blake3: return FastHash::blake3Size;
+            default: return 0;
+            }
+        }
+    };
+
+    // the cypher is a chain, so its state has to be kept between the chunks
+    struct CipherState
+    {
+        const char* key;
+        qint64 pos;
+        char lastChar;
+
+        void encrypt(char* data, qint64 len)
+        {
+            encryptChain(data, len, key, pos, lastChar);
+            pos += len;
+        }
+
+        void decrypt(char* data, qint64 len)
+        {
+            decryptChain(data, len, key, pos, lastChar);
+            pos += len;
+        }
+    };
+
+    // returns 0 at the end of the data and -1 on error
+    qint64 readChunk(QIODevice* dev, char* data, qint64 maxSize)
+    {
+        forever {
+            qint64 n = dev->read(data, maxSize);
+            if (n > 0)
+                return n;
+            if (n == 0 && dev->isSequential() && dev->waitForReadyRead(-1))
+                continue;
+            return (n == 0 || dev->atEnd()) ? 0 : -1;
+        }
+    }
+
+    bool writeAll(QIODevice* dev, const char* data, qint64 len)
+    {
+        return dev->write(data, len) == len;
+    }
+
+    // returns less than len only at the end of the data, -1 on error
+    qint64 readFully(QIODevice* dev, char* data, qint64 len)
+    {
+        qint64 pos = 0;
+        while (pos < len) {
+            qint64 n = readChunk(dev, data + pos, len - pos);
+            if (n < 0)
+                return -1;
+            if (!n)
+                break;
+            pos += n;
+        }
+        return pos;
+    }
+
+    // xoshiro256**, one per thread and seeded once from the OS,
+    // so any number of instances can be used from any number of threads without sharing state
+    class Random
+    {
+    public:
+        static Random& local()
+        {
+            thread_local Random random;
+            return random;
+        }
+
+        quint64 next()
+        {
+            quint64 res = rotl(m_s[1] * 5, 7) * 9;
+            quint64 t = m_s[1] << 17;
+            m_s[2] ^= m_s[0];
+            m_s[3] ^= m_s[1];
+            m_s[1] ^= m_s[2];
+            m_s[0] ^= m_s[3];
+            m_s[2] ^= t;
+            m_s[3] = rotl(m_s[3], 45);
+            return res;
+        }
+
+        char nextChar() {return char(next() >> 56);}
+
+    private:
+        quint64 m_s[4];
+
+        Random()
+        {
+            quint64 seed[4] = {};
+#ifdef Q_OS_LINUX
+            bool seeded = getrandom(seed, sizeof(seed), GRND_NONBLOCK) == ssize_t(sizeof(seed));
+#else
+            bool seeded = false;
+#endif
+            if (!seeded) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+                QRandomGenerator::system()->fillRange(seed, 4);
+#else
+                seed[0] = quint64(QDateTime::currentMSecsSinceEpoch());
+                seed[1] = quint64(quintptr(QThread::currentThreadId()));
+                seed[2] = quint64(quintptr(this));
+#endif
+            }
+            // splitmix64 spreads the seed and never leaves the state all-zero
+            quint64 x = seed[0] ^ seed[1] ^ seed[2] ^ seed[3];
+            for (int i = 0; i < 4; i++) {
+                x += 0x9E3779B97F4A7C15ULL;
+                quint64 z = x ^ seed[i];
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                m_s[i] = z ^ (z >> 31);
+            }
+        }
+
+        static quint64 rotl(quint64 x, int k) {return (x << k) | (x >> (64 - k));}
+    };
+
+    // A temporary file that never holds the plain data: everything is encrypted on the way in
+    // with a random key that only lives in memory. It's written once, then read from the beginning.
+    class SpoolFile : public QIODevice
+    {
+    public:
+        SpoolFile() :
+            m_writeState {m_keyParts, 0, 0},
+            m_readState {m_keyParts, 0, 0}
+        {
+            quint64 key = Random::local().next();
+            for (int i = 0; i < 8; i++)
+                m_keyParts[i] = char(key >> (i * 8));
+        }
+
+        ~SpoolFile()
+        {
+            close();
+        }
+
+        bool open()
+        {
+            return m_file.open() && QIODevice::open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+        }
+
+        bool isSequential() const {return false;}
+        qint64 size() const {return m_file.size();}
+
+        // the chain can only be restarted from the beginning
+        bool seek(qint64 pos)
+        {
+            if (pos != 0 || !m_file.seek(0))
+                return false;
+            m_readState = CipherState {m_keyParts, 0, 0};
+            return QIODevice::seek(0);
+        }
+
+    protected:
+        qint64 readData(char* data, qint64 maxSize)
+        {
+            qint64 n = m_file.read(data, maxSize);
+            if (n > 0)
+                m_readState.decrypt(data, n);
+            return n;
+        }
+
+        qint64 writeData(const char* data, qint64 maxSize)
+        {
+            m_buffer.resize(int(qMin(maxSize, streamChunkSize)));
+            for (qint64 done = 0; done < maxSize; ) {
+                qint64 n = qMin<qint64>(maxSize - done, m_buffer.size());
+                memcpy(m_buffer.data(), data + done, size_t(n));
+                m_writeState.encrypt(m_buffer.data(), n);
+                if (m_file.write(m_buffer.constData(), n) != n)
+                    return -1;
+                done += n;
+            }
+            return maxSize;
+        }
+
+    private:
+        char m_keyParts[8];
+        CipherState m_writeState;
+        CipherState m_readState;
+        QTemporaryFile m_file;
+        QByteArray m_buffer;
+    };
+
+    // small enough to stay in the L1 cache between the passes over it
+    const qint64 tileSize = 16 * 1024;
+
+    const qint64 entropySampleSize = 8 * 1024;
+
+    // Byte entropy of the beginning of the data.
+    // Close to 8 bits means the data is already compressed or encrypted and won't get any smaller.
+    bool looksIncompressible(const char* data, qint64 len)
+    {
+        if (len < entropySampleSize)
+            return false; // cheap enough to just try
+        quint32 counts[256] = {};
+        for (qint64 i = 0; i < entropySampleSize; i++)
+            counts[uchar(data[i])]++;
+        double entropy = 0;
+        for (quint32 c : counts) {
+            if (c) {
+                double p = double(c) / entropySampleSize;
+                entropy -= p * std::log2(p);
+            }
+        }
+        return entropy > 7.9;
+    }
+
+    int defaultLevel(SimpleCrypt::CompressionCodec codec)
+    {
+        switch (codec) {
+        case SimpleCrypt::CodecZstd: return 3;
+        case SimpleCrypt::CodecLz4: return 0;
+        default: return 9;
+        }
+    }
+
+    SimpleCrypt::CryptoFlags codecFlag(SimpleCrypt::CompressionCodec codec)
+    {
+        switch (codec) {
+        case SimpleCrypt::CodecZstd: return SimpleCrypt::CryptoFlagZstd;
+        case SimpleCrypt::CodecLz4: return SimpleCrypt::CryptoFlagLz4;
+        default: return SimpleCrypt::CryptoFlagNone;
+        }
+    }
+
+    // returns false if the flags name an unknown codec or one that this build doesn't have
+    bool codecFromFlags(SimpleCrypt::CryptoFlags flags, SimpleCrypt::CompressionCodec& codec)
+    {
+        switch (int(flags & SimpleCrypt::CryptoFlagCodecMask)) {
+        case SimpleCrypt::CryptoFlagNone: codec = SimpleCrypt::CodecZlib; break;
+        case SimpleCrypt::CryptoFlagZstd: codec = SimpleCrypt::CodecZstd; break;
+        case SimpleCrypt::CryptoFlagLz4: codec = SimpleCrypt::CodecLz4; break;
+        default: return false;
+        }
+        return SimpleCrypt::isCodecAvailable(codec);
+    }
+
+    // returns false if the integrity field names a method that this version doesn't know
+    bool knownFlags(SimpleCrypt::CryptoFlags flags)
+    {
+        return int(flags & SimpleCrypt::CryptoFlagIntegrityMask) <= SimpleCrypt::CryptoFlagBlake3;
+    }
+
+#ifdef SIMPLECRYPT_LZ4
+    LZ4F_preferences_t lz4Preferences(int level)
+    {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = level;
+        return prefs;
+    }
+#endif
+
+    // The compressed payload is the big-endian length of the plain data followed by the codec's stream
+    // (no stream at all for empty data), as produced by qCompress() for zlib.
+
+    // worst case of the codec's stream size
+    qint64 compressBound(SimpleCrypt::CompressionCodec codec, qint64 len)
+    {
+        switch (codec) {
+#ifdef SIMPLECRYPT_ZSTD
+        case SimpleCrypt::CodecZstd: return qint64(ZSTD_compressBound(size_t(len)));
+#endif
+#ifdef SIMPLECRYPT_LZ4
+        case SimpleCrypt::CodecLz4: {
+            LZ4F_preferences_t prefs = lz4Preferences(0);
+            return qint64(LZ4F_compressFrameBound(size_t(len), &prefs));
+        }
+#endif
+        default: return qint64(::compressBound(uLong(len)));
+        }
+    }
+
+    // the most that len bytes of the codec's stream can decompress to
+    qint64 decompressBound(SimpleCrypt::CompressionCodec codec, qint64 len)
+    {
+        switch (codec) {
+        // a 4-byte RLE block is at most 128 KiB
+        case SimpleCrypt::CodecZstd: return len * (128 * 1024 / 4);
+        // every extra length byte of a match adds 255 bytes
+        case SimpleCrypt::CodecLz4: return len * 256;
+        // a deflate match is at most 258 bytes and takes at least 2 bits
+        default: return len * 1032;
+        }
+    }
+
+    // one-shot compression of the stream; returns its size or -1 if it doesn't fit into dst
+    qint64 compressStream(SimpleCrypt::CompressionCodec codec, int level, const char* src, qint64 len, char* dst, qint64 capacity)
+    {
+        switch (codec) {
+#ifdef SIMPLECRYPT_ZSTD
+        case SimpleCrypt::CodecZstd: {
+            size_t res = ZSTD_compress(dst, size_t(capacity), src, size_t(len), level);
+            return ZSTD_isError(res) ? -1 : qint64(res);
+        }
+#endif
+#ifdef SIMPLECRYPT_LZ4
+        case SimpleCrypt::CodecLz4: {
+            LZ4F_preferences_t prefs = lz4Preferences(level);
+            size_t res = LZ4F_compressFrame(dst, size_t(capacity), src, size_t(len), &prefs);
+            return LZ4F_isError(res) ? -1 : qint64(res);
+        }
+#endif
+        default: {
+            uLongf res = uLongf(capacity);
+            if (compress2(reinterpret_cast<Bytef*>(dst), &res, reinterpret_cast<const Bytef*>(src), uLong(len), level) != Z_OK)
+                return -1;
+            return qint64(res);
+        }
+        }
+    }
+
+    using Sink = std::function<bool(const char* data, qint64 len)>;
+
+    // streaming counterpart of compressStream(); nothing is produced if no data was added
+    class Compressor
+    {
+    public:
+        Compressor(SimpleCrypt::CompressionCodec codec, int level) : m_codec(codec), m_level(level) {}
+        Compressor(const Compressor&) = delete;
+
+        ~Compressor()
+        {
+            if (!m_started)
+                return;
+            switch (m_codec) {
+#ifdef SIMPLECRYPT_ZSTD
+            case SimpleCrypt::CodecZstd: ZSTD_freeCCtx(m_zstd); break;
+#endif
+#ifdef SIMPLECRYPT_LZ4
+            case SimpleCrypt::CodecLz4: LZ4F_freeCompressionContext(m_lz4); break;
+#endif
+            default: deflateEnd(&m_zs); break;
+            }
+        }
+
+        bool add(const char* data, qint64 len, const Sink& sink)
+        {
+            if (!len)
+                return true;
+            if (!m_started && !start(sink))
+                return false;
+
+            switch (m_codec) {
+#ifdef SIMPLECRYPT_ZSTD
+            case SimpleCrypt::CodecZstd: {
+                ZSTD_inBuffer in {data, size_t(len), 0};
+                do {
+                    ZSTD_outBuffer out {m_buf.data(), size_t(m_buf.size()), 0};
+                    if (ZSTD_isError(ZSTD_compressStream2(m_zstd, &out, &in, ZSTD_e_continue)))
+                        return false;
+                    if (!sink(m_buf.constData(), qint64(out.pos)))
+                        return false;
+                } while (in.pos < in.size);
+                return true;
+            }
+#endif
+#ifdef SIMPLECRYPT_LZ4
+            case SimpleCrypt::CodecLz4:
+                // the output buffer only fits the worst case of lz4Step bytes
+                while (len) {
+                    qint64 step = qMin(len, lz4Step);
+                    size_t res = LZ4F_compressUpdate(m_lz4, m_buf.data(), size_t(m_buf.size()), data, size_t(step), nullptr);
+                    if (LZ4F_isError(res) || !sink(m_buf.constData(), qint64(res)))
+                        return false;
+                    data += step;
+                    len -= step;
+                }
+                return true;
+#endif
+            default:
+                m_zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                m_zs.avail_in = uInt(len);
+                do {
+                    m_zs.next_out = reinterpret_cast<Bytef*>(m_buf.data());
+                    m_zs.avail_out = uInt(m_buf.size());
+                    deflate(&m_zs, Z_NO_FLUSH);
+                    if (!sink(m_buf.constData(), m_buf.size() - qint64(m_zs.avail_out)))
+                        return false;
+                } while (m_zs.avail_out == 0);
+                return true;
+            }
+        }
+
+        bool finish(const Sink& sink)
+        {
+            if (!m_started)
+                return true;
+
+            switch (m_codec) {
+#ifdef SIMPLECRYPT_ZSTD
+            case SimpleCrypt::CodecZstd: {
+                ZSTD_inBuffer in {nullptr, 0, 0};
+                size_t res;
+                do {
+                    ZSTD_outBuffer out {m_buf.data(), size_t(m_buf.size()), 0};
+                    res = ZSTD_compressStream2(m_zstd, &out, &in, ZSTD_e_end);
+                    if (ZSTD_isError(res) || !sink(m_buf.constData(), qint64(out.pos)))
+                        return false;
+                } while (res);
+                return true;
+            }
+#endif
+#ifdef SIMPLECRYPT_LZ4
+            case SimpleCrypt::CodecLz4: {
+                size_t res = LZ4F_compressEnd(m_lz4, m_buf.data(), size_t(m_buf.size()), nullptr);
+                return !LZ4F_isError(res) && sink(m_buf.constData(), qint64(res));
+            }
+#endif
+            default: {
+                int res = Z_OK;
+                while (res != Z_STREAM_END) {
+                    m_zs.next_out = reinterpret_cast<Bytef*>(m_buf.data());
+                    m_zs.avail_out = uInt(m_buf.size());
+                    res = deflate(&m_zs, Z_FINISH);
+                    if (res == Z_STREAM_ERROR || !sink(m_buf.constData(), m_buf.size() - qint64(m_zs.avail_out)))
+                        return false;
+                }
+                return true;
+            }
+            }
+        }
+
+    private:
+        static const qint64 lz4Step = 16 * 1024;
+
+        SimpleCrypt::CompressionCodec m_codec;
+        int m_level;
+        bool m_started = false;
+        QByteArray m_buf;
+        z_stream m_zs {};
+#ifdef SIMPLECRYPT_ZSTD
+        ZSTD_CCtx* m_zstd = nullptr;
+#endif
+#ifdef SIMPLECRYPT_LZ4
+        LZ4F_cctx* m_lz4 = nullptr;
+#endif
+
+        bool start(const Sink& sink)
+        {
+            m_started = true;
+            switch (m_codec) {
+#ifdef SIMPLECRYPT_ZSTD
+            case SimpleCrypt::CodecZstd:
+                m_buf.resize(int(ZSTD_CStreamOutSize()));
+                m_zstd = ZSTD_createCCtx();
+                return m_zstd && !ZSTD_isError(ZSTD_CCtx_setParameter(m_zstd, ZSTD_c_compressionLevel, m_level));
+#endif
+#ifdef SIMPLECRYPT_LZ4
+            case SimpleCrypt::CodecLz4: {
+                if (LZ4F_isError(LZ4F_createCompressionContext(&m_lz4, LZ4F_VERSION))) {
+                    m_lz4 = nullptr;
+                    return false;
+                }
+                LZ4F_preferences_t prefs = lz4Preferences(m_level);
+                m_buf.resize(int(qMax<size_t>(LZ4F_compressBound(size_t(lz4Step), &prefs), LZ4F_HEADER_SIZE_MAX)));
+                size_t res = LZ4F_compressBegin(m_lz4, m_buf.data(), size_t(m_buf.size()), &prefs);
+                return !LZ4F_isError(res) && sink(m_buf.constData(), qint64(res));
+            }
+#endif
+            default:
+                m_buf.resize(int(streamChunkSize));
+                return deflateInit(&m_zs, m_level) == Z_OK;
+            }
+        }
+    };
+
+    class Decompressor
+    {
+    public:
+        enum Status {More, End, Corrupted};
+
+        explicit Decompressor(SimpleCrypt::CompressionCodec codec) : m_codec(codec) {}
+        Decompressor(const Decompressor&) = delete;
+
+        ~Decompressor()
+        {
+            if (!m_started)
+                return;
+            switch (m_codec) {
+#ifdef SIMPLECRYPT_ZSTD
+            case SimpleCrypt::CodecZstd: ZSTD_freeDCtx(m_zstd); break;
+#endif
+#ifdef SIMPLECRYPT_LZ4
+            case SimpleCrypt::CodecLz4: LZ4F_freeDecompressionContext(m_lz4); break;
+#endif
+            default: inflateEnd(&m_zs); break;
+            }
+        }
+
+        // consumes the input and fills the output as far as possible, advancing both
+        Status run(const char*& in, qint64& inLen, char*& out, qint64& outLen)
+        {
+            if (m_ended)
+                return End;
+            if (!m_started && !start())
+                return Corrupted;
+
+            switch (m_codec) {
+#ifdef SIMPLECRYPT_ZSTD
+            case SimpleCrypt::CodecZstd: {
+                ZSTD_inBuffer inBuf {in, size_t(inLen), 0};
+                ZSTD_outBuffer outBuf {out, size_t(outLen), 0};
+                size_t res = ZSTD_decompressStream(m_zstd, &outBuf, &inBuf);
+                advance(in, inLen, out, outLen, qint64(inBuf.pos), qint64(outBuf.pos));
+                if (ZSTD_isError(res))
+                    return Corrupted;
+                m_ended = res == 0;
+                break;
+            }
+#endif
+#ifdef SIMPLECRYPT_LZ4
+            case SimpleCrypt::CodecLz4: {
+                size_t inSize = size_t(inLen);
+                size_t outSize = size_t(outLen);
+                size_t res = LZ4F_decompress(m_lz4, out, &outSize, in, &inSize, nullptr);
+                advance(in, inLen, out, outLen, qint64(inSize), qint64(outSize));
+                if (LZ4F_isError(res))
+                    return Corrupted;
+                m_ended = res == 0;
+                break;
+            }
+#endif
+            default: {
+                m_zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+                m_zs.avail_in = uInt(inLen);
+                m_zs.next_out = reinterpret_cast<Bytef*>(out);
+                m_zs.avail_out = uInt(outLen);
+                int res = inflate(&m_zs, Z_NO_FLUSH);
+                advance(in, inLen, out, outLen, inLen - qint64(m_zs.avail_in), outLen - qint64(m_zs.avail_out));
+                if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+                    return Corrupted;
+                m_ended = res == Z_STREAM_END;
+                break;
+            }
+            }
+            return m_ended ? End : More;
+        }
+
+        // false if a stream was started but didn't end
+        bool isComplete() const {return !m_started || m_ended;}
+
+    private:
+        SimpleCrypt::CompressionCodec m_codec;
+        bool m_started = false;
+        bool m_ended = false;
+        z_stream m_zs {};
+#ifdef SIMPLECRYPT_ZSTD
+        ZSTD_DCtx* m_zstd = nullptr;
+#endif
+#ifdef SIMPLECRYPT_LZ4
+        LZ4F_dctx* m_lz4 = nullptr;
+#endif
+
+        bool start()
+        {
+            m_started = true;
+            switch (m_codec) {
+#ifdef SIMPLECRYPT_ZSTD
+            case SimpleCrypt::CodecZstd:
+                m_zstd = ZSTD_createDCtx();
+                return m_zstd;
+#endif
+#ifdef SIMPLECRYPT_LZ4
+            case SimpleCrypt::CodecLz4:
+                if (LZ4F_isError(LZ4F_createDecompressionContext(&m_lz4, LZ4F_VERSION))) {
+                    m_lz4 = nullptr;
+                    return false;
+                }
+                return true;
+#endif
+            default:
+                return inflateInit(&m_zs) == Z_OK;
+            }
+        }
+
+        static void advance(const char*& in, qint64& inLen, char*& out, qint64& outLen, qint64 consumed, qint64 produced)
+        {
+            in += consumed;
+            inLen -= consumed;
+            out += produced;
+            outLen -= produced;
+        }
+    };
+
+    // batch items are processed in groups of about this many bytes (or one large item);
+    // itemCost accounts for the fixed per-item work, so that a lot of empty items are grouped too
+    const qint64 minBatchGroupSize = 64 * 1024;
+    const qint64 batchItemCost = 256;
+
+    struct BatchGroup
+    {
+        int first;
+        int last; // exclusive
+    };
+
+    QVector<BatchGroup> batchGroups(const QByteArrayList& items)
+    {
+        QVector<BatchGroup> groups;
+        qint64 groupSize = 0;
+        int first = 0;
+        for (int i = 0; i < items.size(); i++) {
+            groupSize += items.at(i).size() + batchItemCost;
+            if (groupSize >= minBatchGroupSize) {
+                groups.append({first, i + 1});
+                first = i + 1;
+                groupSize = 0;
+            }
+        }
+        if (first < items.size())
+            groups.append({first, items.size()});
+        return groups;
+    }
+
+    // the size of the slot of an item of the given size, or 0 and ErrorBufferTooSmall if it doesn't fit after total;
+    // the size comes from the item itself, so it can be anything
+    qint64 batchSlotSize(qint64 size, qint64 total, SimpleCrypt::Error& error)
+    {
+        if (size > INT_MAX - total) {
+            error = SimpleCrypt::ErrorBufferTooSmall;
+            return 0;
+        }
+        return size;
+    }
+
+    // items were written to slots of the worst-case size; moves them back to back
+    void compactBatch(SimpleCrypt::BatchResult& result, const QVector<qint64>& slots, const QVector<qint64>& sizes)
+    {
+        char* arena = result.data.data();
+        qint64 pos = 0;
+        for (int i = 0; i < sizes.size(); i++) {
+            result.offsets[i] = pos;
+            qint64 n = qMax<qint64>(0, sizes.at(i));
+            if (n && slots.at(i) != pos)
+                memmove(arena + pos, arena + slots.at(i), size_t(n));
+            pos += n;
+        }
+        result.offsets[sizes.size()] = pos;
+        result.data.resize(int(pos));
+    }
+
+    /*
+      Version 4: [4][flags][nonce: 8][block size: 4][plain size: 8][index: 8 per block][blocks]
+      The plain data is split into blocks of the same size (except the last one) that are encrypted independently,
+      each with its own key and seed derived from the key, the random nonce and the block index.
+      So any block can be decrypted without the ones before it, and all of them can be processed in parallel.
+      The index holds the end of every block, counted from the first one, with the top bit set for a compressed block.
+      A block is the integrity protection of its payload followed by the payload (the plain data or the codec's stream),
+      encrypted with the same chain as version 3.
+      */
+    const qint64 blockHeaderSize = 22;
+    const quint64 blockCompressedBit = quint64(1) << 63;
+    // the header and the index must fit into a QByteArray
+    const qint64 maxBlockCount = (INT_MAX - blockHeaderSize) / 8;
+    // the plain data of a stream is processed in groups of about this many bytes
+    const qint64 blockStreamGroupSize = 16 * 1024 * 1024;
+
+    inline quint64 mix64(quint64 x)
+    {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    struct BlockKey
+    {
+        char key[8];
+        char seed;
+
+        BlockKey(quint64 key, quint64 nonce, qint64 index)
+        {
+            quint64 k = mix64(key ^ mix64(nonce + quint64(index) * 0x9E3779B97F4A7C15ULL));
+            qToLittleEndian(k, this->key);
+            seed = char(mix64(k));
+        }
+    };
+
+    class BlockCipher
+    {
+    public:
+        quint64 key;
+        const char* keyParts;
+        SimpleCrypt::CryptoFlags flags;
+        SimpleCrypt::CompressionMode mode = SimpleCrypt::CompressionNever;
+        SimpleCrypt::CompressionCodec codec = SimpleCrypt::CodecZlib;
+        int level = 0;
+        quint64 nonce = 0;
+        qint64 blockSize = 0;
+        qint64 plainSize = 0;
+        qint64 blockCount = 0;
+        int integritySize = 0;
+
+        // for decryption, the rest comes from the header
+        BlockCipher(quint64 key, const char* keyParts) : key(key), keyParts(keyParts) {}
+
+        BlockCipher(quint64 key, const char* keyParts, SimpleCrypt::CryptoFlags flags,
+                    SimpleCrypt::CompressionMode mode, SimpleCrypt::CompressionCodec codec, int level, int blockSize) :
+            key(key), keyParts(keyParts), mode(mode), codec(codec), level(level),
+            nonce(Random::local().next()), blockSize(blockSize)
+        {
+            setFlags(flags);
+        }
+
+        void setFlags(SimpleCrypt::CryptoFlags flags)
+        {
+            this->flags = flags;
+            integritySize = Integrity::size(flags);
+        }
+
+        void setPlainSize(qint64 size)
+        {
+            plainSize = size;
+            blockCount = (size + blockSize - 1) / blockSize;
+        }
+
+        qint64 dataStart() const {return blockHeaderSize + blockCount * 8;}
+        qint64 plainBlockSize(qint64 index) const {return qMin(blockSize, plainSize - index * blockSize);}
+
+        qint64 maxEncryptedSize(qint64 len) const
+        {
+            if (!flags.testFlag(SimpleCrypt::CryptoFlagCompression))
+                return integritySize + len;
+            return integritySize + qMax(len, compressBound(codec, len));
+        }
+
+        void writeHeader(char* out) const
+        {
+            out[0] = char(0x04);
+            out[1] = char(flags);
+            qToBigEndian(nonce, out + 2);
+            qToBigEndian(quint32(blockSize), out + 10);
+            qToBigEndian(quint64(plainSize), out + 14);
+        }
+
+        // header is blockHeaderSize bytes
+        bool readHeader(const char* header, SimpleCrypt::Error& error)
+        {
+            if (header[0] != 4) {
+                error = SimpleCrypt::ErrorUnknownVersion;
+                return false;
+            }
+            setFlags(SimpleCrypt::CryptoFlags(uchar(header[1])));
+            nonce = qFromBigEndian<quint64>(header + 2);
+            blockSize = qFromBigEndian<quint32>(header + 10);
+            quint64 size = qFromBigEndian<quint64>(header + 14);
+            if (!knownFlags(flags) || blockSize < SimpleCrypt::minBlockSize || blockSize > SimpleCrypt::maxBlockSize
+                    || size > quint64(maxBlockCount) * quint64(blockSize)) {
+                error = SimpleCrypt::ErrorUnknownVersion;
+                return false;
+            }
+            setPlainSize(qint64(size));
+            if (flags.testFlag(SimpleCrypt::CryptoFlagCompression) && !codecFromFlags(flags, codec)) {
+                error = SimpleCrypt::ErrorUnsupportedCodec;
+                qWarning() << "Compressed with an unsupported codec.";
+                return false;
+            }
+            return true;
+        }
+
+        // the header and the index of size bytes of cyphertext; the index has to match the data
+        bool readLayout(const char* cyphertext, qint64 size, QVector<quint64>& ends, SimpleCrypt::Error& error)
+        {
+            if (size < blockHeaderSize) {
+                error = SimpleCrypt::ErrorUnknownVersion;
+                return false;
+            }
+            if (!readHeader(cyphertext, error))
+                return false;
+            if (size < dataStart() || !readIndex(cyphertext + blockHeaderSize, size - dataStart(), ends)) {
+                error = SimpleCrypt::ErrorIntegrityFailed;
+                return false;
+            }
+            return true;
+        }
+
+        // out must have maxEncryptedSize() bytes; returns the size of the block
+        qint64 encryptBlock(qint64 index, const char* plain, char* out, bool& compressed) const
+        {
+            qint64 len = plainBlockSize(index);
+            char* payload = out + integritySize;
+            qint64 payloadSize = len;
+            compressed = false;
+            if (flags.testFlag(SimpleCrypt::CryptoFlagCompression)
+                    && (mode == SimpleCrypt::CompressionAlways || !looksIncompressible(plain, len))) {
+                qint64 res = compressStream(codec, level, plain, len, payload, compressBound(codec, len));
+                if (res >= 0 && (mode == SimpleCrypt::CompressionAlways || res < len)) {
+                    payloadSize = res;
+                    compressed = true;
+                }
+            }
+            Integrity integrity(flags, keyParts);
+            if (compressed) {
+                integrity.add(payload, payloadSize);
+            } else {
+                for (qint64 pos = 0; pos < len; pos += tileSize) {
+                    qint64 n = qMin(tileSize, len - pos);
+                    memcpy(payload + pos, plain + pos, size_t(n));
+                    integrity.add(payload + pos, n);
+                }
+            }
+            integrity.write(out);
+            BlockKey blockKey(key, nonce, index);
+            char lastChar = blockKey.seed;
+            encryptChain(out, integritySize + payloadSize, blockKey.key, 0, lastChar);
+            return integritySize + payloadSize;
+        }
+
+        // decrypts and verifies a block into out, which must have plainBlockSize() bytes;
+        // buf holds the compressed payload
+        bool decryptBlock(qint64 index, const char* in, qint64 len, bool compressed, char* out, QByteArray& buf) const
+        {
+            qint64 plainLen = plainBlockSize(index);
+            qint64 payloadSize = len - integritySize;
+            if (payloadSize < 0 || (!compressed && payloadSize != plainLen) || (compressed && payloadSize > INT_MAX))
+                return false;
+
+            BlockKey blockKey(key, nonce, index);
+            char lastChar = blockKey.seed;
+            char stored[Integrity::maxSize];
+            memcpy(stored, in, size_t(integritySize));
+            decryptChain(stored, integritySize, blockKey.key, 0, lastChar);
+            Integrity integrity(flags, keyParts);
+            const char* payload = in + integritySize;
+
+            if (!compressed) {
+                for (qint64 pos = 0; pos < payloadSize; pos += tileSize) {
+                    qint64 n = qMin(tileSize, payloadSize - pos);
+                    memcpy(out + pos, payload + pos, size_t(n));
+                    decryptChain(out + pos, n, blockKey.key, integritySize + pos, lastChar);
+                    integrity.add(out + pos, n);
+                }
+                return integrity.matches(stored);
+            }
+
+            if (!flags.testFlag(SimpleCrypt::CryptoFlagCompression))
+                return false;
+            buf.resize(int(payloadSize));
+            memcpy(buf.data(), payload, size_t(payloadSize));
+            decryptChain(buf.data(), payloadSize, blockKey.key, integritySize, lastChar);
+            integrity.add(buf.constData(), payloadSize);
+            if (!integrity.matches(stored))
+                return false;
+
+            Decompressor decompressor(codec);
+            Decompressor::Status status = Decompressor::More;
+            const char* z = buf.constData();
+            qint64 zLen = payloadSize;
+            while (status == Decompressor::More) {
+                qint64 inBefore = zLen;
+                qint64 outBefore = plainLen;
+                status = decompressor.run(z, zLen, out, plainLen);
+                if (zLen == inBefore && plainLen == outBefore)
+                    break;
+            }
+            return status == Decompressor::End && !plainLen;
+        }
+
+        // the ends of all blocks from the index; false if they don't fit into dataSize bytes
+        bool readIndex(const char* index, qint64 dataSize, QVector<quint64>& ends) const
+        {
+            ends.resize(int(blockCount));
+            return checkIndex(index, 0, blockCount, 0, ends.data()) && (ends.isEmpty() ? 0 : blockEnd(ends.last())) == dataSize;
+        }
+
+        // reads the index entries of the blocks from first to last (exclusive) that start at start
+        bool checkIndex(const char* index, qint64 first, qint64 last, qint64 start, quint64* ends) const
+        {
+            qint64 prev = start;
+            for (qint64 i = first; i < last; i++) {
+                quint64 entry = qFromBigEndian<quint64>(index + (i - first) * 8);
+                qint64 end = blockEnd(entry);
+                if (end < prev || end - prev > maxEncryptedSize(plainBlockSize(i)))
+                    return false;
+                ends[i - first] = entry;
+                prev = end;
+            }
+            return true;
+        }
+
+        static qint64 blockEnd(quint64 entry) {return qint64(entry & ~blockCompressedBit);}
+
+        // Encrypts the blocks from first to last (exclusive) in parallel.
+        // The plain data of the first one is at plain, the result is written to out back to back,
+        // the index entries (relative to out) are stored in ends; returns the total size.
+        qint64 encryptBlocks(qint64 first, qint64 last, const char* plain, char* out, quint64* ends) const
+        {
+            qint64 slot = maxEncryptedSize(blockSize);
+            forBlockRanges(first, last, [&](qint64 from, qint64 to) {
+                for (qint64 i = from; i < to; i++) {
+                    bool compressed;
+                    qint64 n = encryptBlock(i, plain + (i - first) * blockSize, out + (i - first) * slot, compressed);
+                    ends[i - first] = quint64(n) | (compressed ? blockCompressedBit : 0);
+                }
+            });
+            // the blocks were written to slots of the worst-case size
+            qint64 pos = 0;
+            for (qint64 i = first; i < last; i++) {
+                qint64 n = blockEnd(ends[i - first]);
+                if ((i - first) * slot != pos)
+                    memmove(out + pos, out + (i - first) * slot, size_t(n));
+                pos += n;
+                ends[i - first] = quint64(pos) | (ends[i - first] & blockCompressedBit);
+            }
+            return pos;
+        }
+
+        // Decrypts the blocks from first to last (exclusive) in parallel.
+        // data is the cyphertext of the first block, which starts at start, ends are the index entries of the blocks.
+        // The result is written to out back to back.
+        bool decryptBlocks(qint64 first, qint64 last, const quint64* ends, qint64 start, const char* data, char* out) const
+        {
+            std::atomic<bool> ok(true);
+            forBlockRanges(first, last, [&](qint64 from, qint64 to) {
+                QByteArray buf;
+                for (qint64 i = from; i < to && ok.load(std::memory_order_relaxed); i++) {
+                    qint64 blockStart = i == first ? start : blockEnd(ends[i - first - 1]);
+                    qint64 len = blockEnd(ends[i - first]) - blockStart;
+                    bool compressed = ends[i - first] & blockCompressedBit;
+                    if (!decryptBlock(i, data + blockStart - start, len, compressed, out + (i - first) * blockSize, buf))
+                        ok = false;
+                }
+            });
+            return ok;
+        }
+
+    private:
+        // runs func on ranges of blocks, in parallel if there's more than one range
+        void forBlockRanges(qint64 first, qint64 last, const std::function<void(qint64 from, qint64 to)>& func) const
+        {
+            qint64 perRange = qMax<qint64>(1, minBatchGroupSize / blockSize);
+            QVector<BatchGroup> ranges;
+            for (qint64 i = first; i < last; i += perRange)
+                ranges.append({int(i), int(qMin(last, i + perRange))});
+            if (ranges.size() == 1) {
+                func(first, last);
+                return;
+            }
+            QtConcurrent::blockingMap(ranges, [&func](BatchGroup& range) {
+                func(range.first, range.last);
+            });
+        }
+    };
+
+    // reads len bytes at pos of the cyphertext; ErrorIntegrityFailed means the cyphertext is too short
+    using BlockReader = std::function<SimpleCrypt::Error(qint64 pos, char* data, qint64 len)>;
+
+    // Decrypts size bytes (-1 means up to the end) of the plain data starting at offset
+    // from a version 4 cyphertext, reading only the blocks that contain them.
+    QByteArray decryptBlockRange(BlockCipher& cipher, const BlockReader& read, qint64 offset, qint64 size, SimpleCrypt::Error& error)
+    {
+        char header[blockHeaderSize];
+        error = read(0, header, blockHeaderSize);
+        if (error != SimpleCrypt::ErrorNoError) {
+            if (error == SimpleCrypt::ErrorIntegrityFailed)
+                error = SimpleCrypt::ErrorUnknownVersion;
+            return QByteArray();
+        }
+        if (!cipher.readHeader(header, error))
+            return QByteArray();
+        offset = qBound<qint64>(0, offset, cipher.plainSize);
+        if (size < 0 || size > cipher.plainSize - offset)
+            size = cipher.plainSize - offset;
+        if (!size) {
+            error = SimpleCrypt::ErrorNoError;
+            return QByteArray();
+        }
+
+        qint64 first = offset / cipher.blockSize;
+        qint64 last = (offset + size - 1) / cipher.blockSize + 1;
+        qint64 plainStart = first * cipher.blockSize;
+        qint64 plainEnd = qMin(cipher.plainSize, last * cipher.blockSize);
+        if (plainEnd - plainStart > INT_MAX) {
+            error = SimpleCrypt::ErrorBufferTooSmall;
+            return QByteArray();
+        }
+
+        // the index entries of the blocks, and the one before them for the start of the first block
+        qint64 indexFirst = qMax<qint64>(0, first - 1);
+        QByteArray index(int((last - indexFirst) * 8), Qt::Uninitialized);
+        error = read(blockHeaderSize + indexFirst * 8, index.data(), index.size());
+        if (error != SimpleCrypt::ErrorNoError)
+            return QByteArray();
+        const char* entries = index.constData();
+        qint64 start = 0;
+        if (first) {
+            start = BlockCipher::blockEnd(qFromBigEndian<quint64>(entries));
+            entries += 8;
+        }
+        QVector<quint64> ends(int(last - first));
+        if (!cipher.checkIndex(entries, first, last, start, ends.data())) {
+            error = SimpleCrypt::ErrorIntegrityFailed;
+            return QByteArray();
+        }
+
+        qint64 end = BlockCipher::blockEnd(ends.last());
+        if (end - start > INT_MAX) {
+            error = SimpleCrypt::ErrorBufferTooSmall;
+            return QByteArray();
+        }
+        QByteArray data(int(end - start), Qt::Uninitialized);
+        error = read(cipher.dataStart() + start, data.data(), data.size());
+        if (error != SimpleCrypt::ErrorNoError)
+            return QByteArray();
+
+        QByteArray plain(int(plainEnd - plainStart), Qt::Uninitialized);
+        if (!cipher.decryptBlocks(first, last, ends.constData(), start, data.constData(), plain.data())) {
+            error = SimpleCrypt::ErrorIntegrityFailed;
+            return QByteArray();
+        }
+        error = SimpleCrypt::ErrorNoError;
+        if (offset != plainStart)
+            plain.remove(0, int(offset - plainStart));
+        plain.truncate(int(size));
+        return plain;
+    }
+
+    // Writes the plain data of the cipher from in as a version 4 cyphertext.
+    // The index precedes the blocks, so it's filled in afterwards if out is seekable, otherwise the blocks are spooled.
+    SimpleCrypt::Error encryptBlockStream(const BlockCipher& cipher, QIODevice* in, QIODevice* out)
+    {
+        if (cipher.blockCount > maxBlockCount)
+            return SimpleCrypt::ErrorBufferTooSmall;
+        QByteArray header(int(cipher.dataStart()), 0);
+        QTemporaryFile spool;
+        QIODevice* blocksOut = out;
+        qint64 outStart = out->pos();
+        if (out->isSequential()) {
+            if (!spool.open())
+                return SimpleCrypt::ErrorIO;
+            blocksOut = &spool;
+        } else if (!writeAll(out, header.constData(), header.size())) {
+            return SimpleCrypt::ErrorIO;
+        }
+
+        qint64 groupBlocks = qMax<qint64>(1, blockStreamGroupSize / cipher.blockSize);
+        QByteArray plain(int(qMin(cipher.plainSize, groupBlocks * cipher.blockSize)), Qt::Uninitialized);
+        QByteArray encrypted(int(qMin(cipher.blockCount, groupBlocks) * cipher.maxEncryptedSize(cipher.blockSize)), Qt::Uninitialized);
+        QVector<quint64> ends(int(cipher.blockCount));
+        qint64 pos = 0;
+        for (qint64 first = 0; first < cipher.blockCount; first += groupBlocks) {
+            qint64 last = qMin(cipher.blockCount, first + groupBlocks);
+            qint64 len = qMin(cipher.plainSize, last * cipher.blockSize) - first * cipher.blockSize;
+            if (readFully(in, plain.data(), len) != len)
+                return SimpleCrypt::ErrorIO;
+            qint64 n = cipher.encryptBlocks(first, last, plain.constData(), encrypted.data(), ends.data() + first);
+            if (!writeAll(blocksOut, encrypted.constData(), n))
+                return SimpleCrypt::ErrorIO;
+            for (qint64 i = first; i < last; i++)
+                ends[int(i)] = quint64(BlockCipher::blockEnd(ends.at(int(i))) + pos) | (ends.at(int(i)) & blockCompressedBit);
+            pos += n;
+        }
+
+        cipher.writeHeader(header.data());
+        for (int i = 0; i < ends.size(); i++)
+            qToBigEndian(ends.at(i), header.data() + blockHeaderSize + i * 8);
+        if (blocksOut == out) {
+            if (!out->seek(outStart) || !writeAll(out, header.constData(), header.size()) || !out->seek(outStart + header.size() + pos))
+                return SimpleCrypt::ErrorIO;
+            return SimpleCrypt::ErrorNoError;
+        }
+        if (!writeAll(out, header.constData(), header.size()) || !spool.seek(0))
+            return SimpleCrypt::ErrorIO;
+        QByteArray buf(int(streamChunkSize), Qt::Uninitialized);
+        qint64 n;
+        while ((n = readChunk(&spool, buf.data(), buf.size())) > 0) {
+            if (!writeAll(out, buf.constData(), n))
+                return SimpleCrypt::ErrorIO;
+        }
+        return n < 0 ? SimpleCrypt::ErrorIO : SimpleCrypt::ErrorNoError;
+    }
+
+    // decrypts a version 4 cyphertext from in, of which the version and the flags were already read
+    SimpleCrypt::Error decryptBlockStream(BlockCipher& cipher, const char* versionAndFlags, QIODevice* in, QIODevice* out)
+    {
+        char header[blockHeaderSize];
+        memcpy(header, versionAndFlags, 2);
+        qint64 n = readFully(in, header + 2, blockHeaderSize - 2);
+        if (n != blockHeaderSize - 2)
+            return n < 0 ? SimpleCrypt::ErrorIO : SimpleCrypt::ErrorUnknownVersion;
+        SimpleCrypt::Error error;
+        if (!cipher.readHeader(header, error))
+            return error;
+
+        QByteArray index(int(cipher.blockCount * 8), Qt::Uninitialized);
+        n = readFully(in, index.data(), index.size());
+        if (n != index.size())
+            return n < 0 ? SimpleCrypt::ErrorIO : SimpleCrypt::ErrorIntegrityFailed;
+        QVector<quint64> ends(int(cipher.blockCount));
+        if (!cipher.checkIndex(index.constData(), 0, cipher.blockCount, 0, ends.data()))
+            return SimpleCrypt::ErrorIntegrityFailed;
+        index.clear();
+
+        qint64 groupBlocks = qMax<qint64>(1, blockStreamGroupSize / cipher.blockSize);
+        QByteArray plain(int(qMin(cipher.plainSize, groupBlocks * cipher.blockSize)), Qt::Uninitialized);
+        QByteArray data;
+        for (qint64 first = 0; first < cipher.blockCount; first += groupBlocks) {
+            qint64 last = qMin(cipher.blockCount, first + groupBlocks);
+            qint64 start = first ? BlockCipher::blockEnd(ends.at(int(first - 1))) : 0;
+            qint64 len = BlockCipher::blockEnd(ends.at(int(last - 1))) - start;
+            data.resize(int(len));
+            n = readFully(in, data.data(), len);
+            if (n != len)
+                return n < 0 ? SimpleCrypt::ErrorIO : SimpleCrypt::ErrorIntegrityFailed;
+            if (!cipher.decryptBlocks(first, last, ends.constData() + first, start, data.constData(), plain.data()))
+                return SimpleCrypt::ErrorIntegrityFailed;
+            qint64 plainLen = qMin(cipher.plainSize, last * cipher.blockSize) - first * cipher.blockSize;
+            if (!writeAll(out, plain.constData(), plainLen))
+                return SimpleCrypt::ErrorIO;
+        }
+        return SimpleCrypt::ErrorNoError;
+    }
+}
 
 SimpleCrypt::SimpleCrypt():
     m_key(0),
     m_compressionMode(CompressionAuto),
+    m_codec(CodecZlib),
+    m_compressionLevel(9),
     m_protectionMode(ProtectionChecksum),
+    m_blockSize(0),
     m_lastError(ErrorNoError)
 {
-    qsrand(uint(QDateTime::currentMSecsSinceEpoch() & 0xFFFF));
 }
 
 SimpleCrypt::SimpleCrypt(quint64 key):
     m_key(key),
     m_compressionMode(CompressionAuto),
+    m_codec(CodecZlib),
+    m_compressionLevel(9),
     m_protectionMode(ProtectionChecksum),
+    m_blockSize(0),
     m_lastError(ErrorNoError)
 {
-    qsrand(uint(QDateTime::currentMSecsSinceEpoch() & 0xFFFF));
     splitKey();
 }
 
-void SimpleCrypt::setKey(quint64 key)
+void SimpleCrypt::setKey(quint64 key)
+{
+    m_key = key;
+    splitKey();
+}
+
+bool SimpleCrypt::setCompressionCodec(CompressionCodec codec, int level)
+{
+    if (!isCodecAvailable(codec))
+        return false;
+    m_codec = codec;
+    m_compressionLevel = level < 0 ? defaultLevel(codec) : level;
+    return true;
+}
+
+void SimpleCrypt::setBlockSize(int size)
+{
+    m_blockSize = size > 0 ? qBound(int(minBlockSize), size, int(maxBlockSize)) : 0;
+}
+
+bool SimpleCrypt::isCodecAvailable(CompressionCodec codec)
+{
+    switch (codec) {
+    case CodecZlib:
+        return true;
+    case CodecZstd:
+#ifdef SIMPLECRYPT_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    case CodecLz4:
+#ifdef SIMPLECRYPT_LZ4
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+void SimpleCrypt::splitKey()
+{
+    m_keyParts.clear();
+    m_keyParts.resize(8);
+    for (int i=0;i<8;i++) {
+        quint64 part = m_key;
+        for (int j=i; j>0; j--)
+            part = part >> 8;
+        part = part & 0xff;
+        m_keyParts[i] = static_cast<char>(part);
+    }
+}
+
+QByteArray SimpleCrypt::encryptToByteArray(const QString& plaintext)
+{
+    QByteArray plaintextArray = plaintext.toUtf8();
+    return encryptToByteArray(plaintextArray);
+}
+
+QByteArray SimpleCrypt::encryptToByteArray(QByteArray plaintext)
+{
+    QByteArray resultArray(int(requiredCiphertextSize(plaintext.size())), Qt::Uninitialized);
+    qint64 len = encrypt(plaintext.constData(), plaintext.size(), resultArray.data(), resultArray.size());
+    if (len < 0)
+        return QByteArray();
+    resultArray.resize(int(len));
+    return resultArray;
+}
+
+QString SimpleCrypt::encryptToString(const QString& plaintext)
+{
+    QByteArray plaintextArray = plaintext.toUtf8();
+    return encryptToString(plaintextArray);
+}
+
+QString SimpleCrypt::encryptToString(QByteArray plaintext)
+{
+    QByteArray cypher = encryptToByteArray(plaintext);
+    return toBase64String(cypher.constData(), cypher.size());
+}
+
+QString SimpleCrypt::decryptToString(const QString &cyphertext)
+{
+    QByteArray plaintextArray = decryptToByteArray(fromBase64String(cyphertext));
+    QString plaintext = QString::fromUtf8(plaintextArray, plaintextArray.size());
+
+    return plaintext;
+}
+
+QString SimpleCrypt::decryptToString(QByteArray cypher)
+{
+    QByteArray ba = decryptToByteArray(cypher);
+    QString plaintext = QString::fromUtf8(ba, ba.size());
+
+    return plaintext;
+}
+
+QByteArray SimpleCrypt::decryptToByteArray(const QString& cyphertext)
 {
-    m_key = key;
-    splitKey();
+    return decryptToByteArray(fromBase64String(cyphertext));
 }
 
-void SimpleCrypt::splitKey()
+QByteArray SimpleCrypt::decryptToByteArray(QByteArray cypher)
 {
-    m_keyParts.clear();
-    m_keyParts.resize(8);
-    for (int i=0;i<8;i++) {
-        quint64 part = m_key;
-        for (int j=i; j>0; j--)
-            part = part >> 8;
-        part = part & 0xff;
-        m_keyParts[i] = static_cast<char>(part);
+    if (m_keyParts.isEmpty()) {
+        qWarning() << "No key set.";
+        m_lastError = ErrorNoKeySet;
+        return QByteArray();
     }
-}
 
-QByteArray SimpleCrypt::encryptToByteArray(const QString& plaintext)
-{
-    QByteArray plaintextArray = plaintext.toUtf8();
-    return encryptToByteArray(plaintextArray);
+    QByteArray ba = std::move(cypher);
+
+    if( ba.count() < 3 )
+        return QByteArray();
+
+    char version = ba.at(0);
+
+    if (version == 4) {
+        qint64 len = plaintextSize(ba.constData(), ba.size());
+        if (len < 0)
+            return QByteArray();
+        if (len > INT_MAX) {
+            m_lastError = ErrorBufferTooSmall;
+            return QByteArray();
+        }
+        QByteArray plain(int(len), Qt::Uninitialized);
+        if (decrypt(ba.constData(), ba.size(), plain.data(), plain.size()) < 0)
+            return QByteArray();
+        return plain;
+    }
+
+    if (version !=3) {  //we only work with version 3 and 4
+        m_lastError = ErrorUnknownVersion;
+        qWarning() << "Invalid version or not a cyphertext.";
+        return QByteArray();
+    }
+
+    CryptoFlags flags = CryptoFlags(uchar(ba.at(1)));
+    if (!knownFlags(flags)) {
+        m_lastError = ErrorUnknownVersion;
+        qWarning() << "Invalid version or not a cyphertext.";
+        return QByteArray();
+    }
+    CompressionCodec codec = CodecZlib;
+    if (flags.testFlag(CryptoFlagCompression) && !codecFromFlags(flags, codec)) {
+        m_lastError = ErrorUnsupportedCodec;
+        qWarning() << "Compressed with an unsupported codec.";
+        return QByteArray();
+    }
+
+    if (!flags.testFlag(CryptoFlagCompression)) {
+        // decrypted and verified in a single pass, in place unless the cyphertext is shared
+        char* data = ba.data();
+        qint64 len = decrypt(data, ba.size(), data, ba.size());
+        if (len < 0)
+            return QByteArray();
+        ba.resize(int(len));
+        return ba;
+    }
+
+    ba = ba.mid(2);
+    char lastChar = 0;
+    decryptChain(ba.data(), ba.count(), m_keyParts.constData(), 0, lastChar);
+
+    ba = ba.mid(1); //chop off the random number at the start
+
+    int integritySize = Integrity::size(flags);
+    if (ba.length() < integritySize) {
+        m_lastError = ErrorIntegrityFailed;
+        return QByteArray();
+    }
+    Integrity integrity(flags, m_keyParts.constData());
+    integrity.add(ba.constData() + integritySize, ba.length() - integritySize);
+    bool integrityOk = integrity.matches(ba.constData());
+    ba = ba.mid(integritySize);
+
+    if (!integrityOk) {
+        m_lastError = ErrorIntegrityFailed;
+        return QByteArray();
+    }
+
+    if (flags.testFlag(CryptoFlagCompression)) {
+        if (codec == CodecZlib) {
+            ba = qUncompress(ba);
+        } else if (ba.size() < 4) {
+            ba = QByteArray();
+        } else {
+            QByteArray plain(int(qFromBigEndian<quint32>(ba.constData())), Qt::Uninitialized);
+            Decompressor decompressor(codec);
+            const char* in = ba.constData() + 4;
+            qint64 inLen = ba.size() - 4;
+            char* out = plain.data();
+            qint64 outLen = plain.size();
+            Decompressor::Status status = Decompressor::More;
+            while (status == Decompressor::More && inLen) {
+                qint64 inBefore = inLen;
+                qint64 outBefore = outLen;
+                status = decompressor.run(in, inLen, out, outLen);
+                if (inLen == inBefore && outLen == outBefore)
+                    break;
+            }
+            // same as qUncompress(): empty on corrupted data
+            if (status == Decompressor::Corrupted || !decompressor.isComplete() || outLen)
+                plain = QByteArray();
+            ba = plain;
+        }
+    }
+
+    m_lastError = ErrorNoError;
+    return ba;
 }
 
-QByteArray SimpleCrypt::encryptToByteArray(QByteArray plaintext)
+bool SimpleCrypt::encrypt(QIODevice *in, QIODevice *out)
 {
     if (m_keyParts.isEmpty()) {
         qWarning() << "No key set.";
         m_lastError = ErrorNoKeySet;
-        return QByteArray();
+        return false;
+    }
+
+    QByteArray buf(int(streamChunkSize), Qt::Uninitialized);
+    qint64 n;
+
+    SpoolFile spool;
+    if (in->isSequential()) {
+        if (!spool.open()) {
+            m_lastError = ErrorIO;
+            return false;
+        }
+        while ((n = readChunk(in, buf.data(), buf.size())) > 0) {
+            if (!writeAll(&spool, buf.constData(), n)) {
+                m_lastError = ErrorIO;
+                return false;
+            }
+        }
+        if (n < 0 || !spool.seek(0)) {
+            m_lastError = ErrorIO;
+            return false;
+        }
+        in = &spool;
     }
+    qint64 start = in->pos();
+    qint64 size = in->size() - start;
 
+    if (m_blockSize) {
+        BlockCipher cipher(m_key, m_keyParts.constData(), encryptionFlags(), m_compressionMode, m_codec, m_compressionLevel, m_blockSize);
+        cipher.setPlainSize(size);
+        m_lastError = encryptBlockStream(cipher, in, out);
+        return m_lastError == ErrorNoError;
+    }
+
+    CryptoFlags integrityFlag = this->integrityFlag();
+
+    // first pass: the integrity of the plain data and the compressed data at once
+    Integrity plainIntegrity(integrityFlag, m_keyParts.constData());
+    Integrity compressedIntegrity(integrityFlag, m_keyParts.constData());
+    SpoolFile compressed;
+    qint64 compressedSize = 0;
+    bool compress = m_compressionMode != CompressionNever;
+    if (m_compressionMode == CompressionAuto && size >= entropySampleSize) {
+        n = readChunk(in, buf.data(), entropySampleSize);
+        if (n < 0 || !in->seek(start)) {
+            m_lastError = ErrorIO;
+            return false;
+        }
+        compress = !looksIncompressible(buf.constData(), n);
+    }
+    // the length header of the compressed data has 32 bits
+    if (compress && size > qint64(UINT_MAX)) {
+        if (m_compressionMode == CompressionAlways) {
+            m_lastError = ErrorBufferTooSmall;
+            return false;
+        }
+        compress = false;
+    }
+    if (compress) {
+        if (!compressed.open()) {
+            m_lastError = ErrorIO;
+            return false;
+        }
+        char lenHeader[4] = {char(size >> 24), char(size >> 16), char(size >> 8), char(size)};
+        compressedIntegrity.add(lenHeader, 4);
+        if (!writeAll(&compressed, lenHeader, 4)) {
+            m_lastError = ErrorIO;
+            return false;
+        }
+        compressedSize = 4;
+    }
 
-    QByteArray ba = plaintext;
+    Compressor compressor(m_codec, m_compressionLevel);
+    Sink sink = [&](const char* data, qint64 len) {
+        compressedIntegrity.add(data, len);
+        compressedSize += len;
+        return writeAll(&compressed, data, len);
+    };
+    bool ok = true;
+    while (ok && (n = readChunk(in, buf.data(), buf.size())) > 0) {
+        if (m_compressionMode != CompressionAlways)
+            plainIntegrity.add(buf.constData(), n);
+        if (compress)
+            ok = compressor.add(buf.constData(), n, sink);
+    }
+    if (ok && compress)
+        ok = compressor.finish(sink);
+    if (!ok || n < 0) {
+        m_lastError = ErrorIO;
+        return false;
+    }
 
-    CryptoFlags flags = CryptoFlagNone;
-    if (m_compressionMode == CompressionAlways) {
-        ba = qCompress(ba, 9); //maximum compression
+    CryptoFlags flags = integrityFlag;
+    QIODevice* payload = in;
+    QByteArray integrityProtection = plainIntegrity.result();
+    if (compress && (m_compressionMode == CompressionAlways || compressedSize < size)) {
         flags |= CryptoFlagCompression;
-    } else if (m_compressionMode == CompressionAuto) {
-        QByteArray compressed = qCompress(ba, 9);
-        if (compressed.count() < ba.count()) {
-            ba = compressed;
-            flags |= CryptoFlagCompression;
+        flags |= codecFlag(m_codec);
+        payload = &compressed;
+        integrityProtection = compressedIntegrity.result();
+        ok = compressed.seek(0);
+    } else {
+        ok = in->seek(start);
+    }
+    if (!ok) {
+        m_lastError = ErrorIO;
+        return false;
+    }
+
+    // second pass: encrypt
+    char header[2] = {char(0x03), char(flags)};
+    if (!writeAll(out, header, 2)) {
+        m_lastError = ErrorIO;
+        return false;
+    }
+
+    CipherState state {m_keyParts.constData(), 0, 0};
+    QByteArray prefix = Random::local().nextChar() + integrityProtection;
+    state.encrypt(prefix.data(), prefix.size());
+    if (!writeAll(out, prefix.constData(), prefix.size())) {
+        m_lastError = ErrorIO;
+        return false;
+    }
+    while ((n = readChunk(payload, buf.data(), buf.size())) > 0) {
+        state.encrypt(buf.data(), n);
+        if (!writeAll(out, buf.constData(), n)) {
+            m_lastError = ErrorIO;
+            return false;
         }
     }
+    if (n < 0) {
+        m_lastError = ErrorIO;
+        return false;
+    }
 
-    QByteArray integrityProtection;
-    if (m_protectionMode == ProtectionChecksum) {
-        flags |= CryptoFlagChecksum;
-        QDataStream s(&integrityProtection, QIODevice::WriteOnly);
-        s << qChecksum(ba.constData(), ba.length());
-    } else if (m_protectionMode == ProtectionHash) {
-        flags |= CryptoFlagHash;
-        QCryptographicHash hash(QCryptographicHash::Sha1);
-        hash.addData(ba);
+    m_lastError = ErrorNoError;
+    return true;
+}
 
-        integrityProtection += hash.result();
+bool SimpleCrypt::decrypt(QIODevice *in, QIODevice *out)
+{
+    if (m_keyParts.isEmpty()) {
+        qWarning() << "No key set.";
+        m_lastError = ErrorNoKeySet;
+        return false;
     }
 
-    //prepend a random char to the string
-    char randomChar = char(qrand() & 0xFF);
-    ba = randomChar + integrityProtection + ba;
+    char header[2];
+    qint64 n = readChunk(in, header, 1);
+    if (n == 1)
+        n = readChunk(in, header + 1, 1);
+    if (n != 1) {
+        m_lastError = n < 0 ? ErrorIO : ErrorUnknownVersion;
+        return false;
+    }
+    if (header[0] == 4) {
+        BlockCipher cipher(m_key, m_keyParts.constData());
+        m_lastError = decryptBlockStream(cipher, header, in, out);
+        return m_lastError == ErrorNoError;
+    }
+    if (header[0] != 3) {  //we only work with version 3 and 4
+        m_lastError = ErrorUnknownVersion;
+        qWarning() << "Invalid version or not a cyphertext.";
+        return false;
+    }
+    CryptoFlags flags = CryptoFlags(uchar(header[1]));
+    if (!knownFlags(flags)) {
+        m_lastError = ErrorUnknownVersion;
+        qWarning() << "Invalid version or not a cyphertext.";
+        return false;
+    }
+    bool compressed = flags.testFlag(CryptoFlagCompression);
+    CompressionCodec codec = CodecZlib;
+    if (compressed && !codecFromFlags(flags, codec)) {
+        m_lastError = ErrorUnsupportedCodec;
+        qWarning() << "Compressed with an unsupported codec.";
+        return false;
+    }
 
-    int pos(0);
-    char lastChar(0);
+    CipherState state {m_keyParts.constData(), 0, 0};
+    Integrity integrity(flags, m_keyParts.constData());
+    QByteArray storedIntegrity;
+    int integritySize = Integrity::size(flags);
+    int skip = 1; // the random char
+    int lenHeaderLeft = compressed ? 4 : 0;
+    Decompressor decompressor(codec);
+    Decompressor::Status status = Decompressor::More;
+    QByteArray buf(int(streamChunkSize), Qt::Uninitialized);
+    QByteArray zbuf(compressed ? int(streamChunkSize) : 0, Qt::Uninitialized);
+    bool ok = true;
+    bool corrupted = false;
 
-    int cnt = ba.count();
+    while (ok && !corrupted && (n = readChunk(in, buf.data(), buf.size())) > 0) {
+        state.decrypt(buf.data(), n);
+        const char* p = buf.constData();
+        if (skip) {
+            int k = int(qMin<qint64>(skip, n));
+            skip -= k;
+            p += k;
+            n -= k;
+        }
+        if (storedIntegrity.size() < integritySize) {
+            int k = int(qMin<qint64>(integritySize - storedIntegrity.size(), n));
+            storedIntegrity.append(p, k);
+            p += k;
+            n -= k;
+        }
+        if (!n)
+            continue;
 
-    while (pos < cnt) {
-        ba[pos] = ba.at(pos) ^ m_keyParts.at(pos % 8) ^ lastChar;
-        lastChar = ba.at(pos);
-        ++pos;
+        integrity.add(p, n);
+        if (!compressed) {
+            ok = writeAll(out, p, n);
+            continue;
+        }
+        if (lenHeaderLeft) {
+            int k = int(qMin<qint64>(lenHeaderLeft, n));
+            lenHeaderLeft -= k;
+            p += k;
+            n -= k;
+        }
+        if (!n || status != Decompressor::More)
+            continue;
+        qint64 zLen;
+        do {
+            char* z = zbuf.data();
+            zLen = zbuf.size();
+            status = decompressor.run(p, n, z, zLen);
+            ok = writeAll(out, zbuf.constData(), zbuf.size() - zLen);
+        } while (ok && status == Decompressor::More && (n || !zLen));
+        corrupted = status == Decompressor::Corrupted;
     }
 
-    QByteArray resultArray;
-    resultArray.append(char(0x03));  //version for future updates to algorithm
-    resultArray.append(char(flags)); //encryption flags
-    resultArray.append(ba);
+    if (n < 0 || !ok) {
+        m_lastError = ErrorIO;
+        return false;
+    }
+    if (skip) {
+        m_lastError = ErrorUnknownVersion;
+        return false;
+    }
+    if (corrupted || storedIntegrity.size() < integritySize || storedIntegrity != integrity.result() || !decompressor.isComplete()) {
+        m_lastError = ErrorIntegrityFailed;
+        return false;
+    }
 
     m_lastError = ErrorNoError;
-    return resultArray;
+    return true;
 }
 
-QString SimpleCrypt::encryptToString(const QString& plaintext)
+SimpleCrypt::CryptoFlags SimpleCrypt::integrityFlag() const
 {
-    QByteArray plaintextArray = plaintext.toUtf8();
-    QByteArray cypher = encryptToByteArray(plaintextArray);
-    QString cypherString = QString::fromLatin1(cypher.toBase64());
-    return cypherString;
+    if (m_protectionMode == ProtectionChecksum)
+        return CryptoFlagChecksum;
+    if (m_protectionMode == ProtectionHash)
+        return CryptoFlagHash;
+    if (m_protectionMode == ProtectionCrc32c)
+        return CryptoFlagCrc32c;
+    if (m_protectionMode == ProtectionXxh64)
+        return CryptoFlagXxh64;
+    if (m_protectionMode == ProtectionBlake3)
+        return CryptoFlagBlake3;
+    return CryptoFlagNone;
 }
 
-QString SimpleCrypt::encryptToString(QByteArray plaintext)
+SimpleCrypt::CryptoFlags SimpleCrypt::encryptionFlags() const
 {
-    QByteArray cypher = encryptToByteArray(plaintext);
-    QString cypherString = QString::fromLatin1(cypher.toBase64());
-    return cypherString;
+    CryptoFlags flags = integrityFlag();
+    if (m_compressionMode != CompressionNever) {
+        flags |= CryptoFlagCompression;
+        flags |= codecFlag(m_codec);
+    }
+    return flags;
 }
 
-QString SimpleCrypt::decryptToString(const QString &cyphertext)
+qint64 SimpleCrypt::requiredCiphertextSize(qint64 plaintextSize, CryptoFlags flags, int blockSize)
 {
-    QByteArray cyphertextArray = QByteArray::fromBase64(cyphertext.toLatin1());
-    QByteArray plaintextArray = decryptToByteArray(cyphertextArray);
-    QString plaintext = QString::fromUtf8(plaintextArray, plaintextArray.size());
+    if (blockSize > 0) {
+        BlockCipher cipher(0, nullptr);
+        cipher.setFlags(flags);
+        codecFromFlags(flags, cipher.codec);
+        cipher.blockSize = blockSize;
+        cipher.setPlainSize(plaintextSize);
+        // the blocks are written to slots of the worst-case size first
+        qint64 full = plaintextSize / blockSize;
+        qint64 rest = plaintextSize % blockSize;
+        return cipher.dataStart() + full * cipher.maxEncryptedSize(blockSize) + (rest ? cipher.maxEncryptedSize(rest) : 0);
+    }
 
-    return plaintext;
+    qint64 payloadSize = plaintextSize;
+    if (flags.testFlag(CryptoFlagCompression)) {
+        CompressionCodec codec = CodecZlib;
+        codecFromFlags(flags, codec);
+        payloadSize = qMax(payloadSize, 4 + compressBound(codec, plaintextSize));
+    }
+    return 3 + Integrity::size(flags) + payloadSize;
 }
 
-QString SimpleCrypt::decryptToString(QByteArray cypher)
+qint64 SimpleCrypt::requiredCiphertextSize(qint64 plaintextSize) const
 {
-    QByteArray ba = decryptToByteArray(cypher);
-    QString plaintext = QString::fromUtf8(ba, ba.size());
+    return requiredCiphertextSize(plaintextSize, encryptionFlags(), m_blockSize);
+}
 
-    return plaintext;
+qint64 SimpleCrypt::encrypt(const char *plaintext, qint64 size, char *cyphertext, qint64 capacity)
+{
+    if (m_keyParts.isEmpty()) {
+        qWarning() << "No key set.";
+        m_lastError = ErrorNoKeySet;
+        return -1;
+    }
+    return encryptTo(plaintext, size, cyphertext, capacity, m_lastError);
 }
 
-QByteArray SimpleCrypt::decryptToByteArray(const QString& cyphertext)
+qint64 SimpleCrypt::encryptTo(const char *plaintext, qint64 size, char *cyphertext, qint64 capacity, Error &error) const
 {
-    QByteArray cyphertextArray = QByteArray::fromBase64(cyphertext.toLatin1());
-    QByteArray ba = decryptToByteArray(cyphertextArray);
+    if (capacity < requiredCiphertextSize(size)) {
+        error = ErrorBufferTooSmall;
+        return -1;
+    }
 
-    return ba;
+    if (m_blockSize) {
+        BlockCipher cipher(m_key, m_keyParts.constData(), encryptionFlags(), m_compressionMode, m_codec, m_compressionLevel, m_blockSize);
+        cipher.setPlainSize(size);
+        if (cipher.blockCount > maxBlockCount) {
+            error = ErrorBufferTooSmall;
+            return -1;
+        }
+        std::vector<char> copy;
+        if (plaintext < cyphertext + capacity && cyphertext < plaintext + size) {
+            copy.assign(plaintext, plaintext + size);
+            plaintext = copy.data();
+        }
+        QVector<quint64> ends(int(cipher.blockCount));
+        qint64 len = cipher.encryptBlocks(0, cipher.blockCount, plaintext, cyphertext + cipher.dataStart(), ends.data());
+        cipher.writeHeader(cyphertext);
+        for (int i = 0; i < ends.size(); i++)
+            qToBigEndian(ends.at(i), cyphertext + blockHeaderSize + i * 8);
+        error = ErrorNoError;
+        return cipher.dataStart() + len;
+    }
+
+    CryptoFlags flags = integrityFlag();
+    int integritySize = Integrity::size(flags);
+    qint64 prefixSize = 3 + integritySize; // version, flags, random char, integrity
+    char* payload = cyphertext + prefixSize;
+    qint64 payloadSize = -1;
+
+    bool compress = m_compressionMode == CompressionAlways
+            || (m_compressionMode == CompressionAuto && !looksIncompressible(plaintext, size));
+    // the codec and the fallback to the uncompressed data both read the plaintext after the payload is written
+    std::vector<char> copy;
+    if (compress && plaintext < cyphertext + capacity && cyphertext < plaintext + size) {
+        copy.assign(plaintext, plaintext + size);
+        plaintext = copy.data();
+    }
+    if (compress) {
+        qint64 compressedSize = 4;
+        qToBigEndian(quint32(size), payload);
+        if (size) {
+            qint64 len = compressStream(m_codec, m_compressionLevel, plaintext, size, payload + 4, capacity - prefixSize - 4);
+            if (len < 0) {
+                error = ErrorBufferTooSmall;
+                return -1;
+            }
+            compressedSize += len;
+        }
+        if (m_compressionMode == CompressionAlways || compressedSize < size) {
+            flags |= CryptoFlagCompression;
+            flags |= codecFlag(m_codec);
+            payloadSize = compressedSize;
+        }
+    }
+    Integrity integrity(flags, m_keyParts.constData());
+    if (payloadSize < 0) {
+        payloadSize = size;
+        if (plaintext + size > payload && plaintext < payload + size) {
+            // overlapping (e.g. in-place encryption)
+            memmove(payload, plaintext, size_t(size));
+            integrity.add(payload, payloadSize);
+        } else {
+            // the integrity is computed on the copy while it's still in the cache
+            for (qint64 pos = 0; pos < size; pos += tileSize) {
+                qint64 n = qMin(tileSize, size - pos);
+                memcpy(payload + pos, plaintext + pos, size_t(n));
+                integrity.add(payload + pos, n);
+            }
+        }
+    } else {
+        integrity.add(payload, payloadSize);
+    }
+    integrity.write(cyphertext + 3);
+
+    cyphertext[0] = char(0x03);  //version for future updates to algorithm
+    cyphertext[1] = char(flags); //encryption flags
+    cyphertext[2] = Random::local().nextChar();
+    char lastChar = 0;
+    encryptChain(cyphertext + 2, 1 + integritySize + payloadSize, m_keyParts.constData(), 0, lastChar);
+
+    error = ErrorNoError;
+    return prefixSize + payloadSize;
 }
 
-QByteArray SimpleCrypt::decryptToByteArray(QByteArray cypher)
+qint64 SimpleCrypt::plaintextSize(const char *cyphertext, qint64 size)
 {
     if (m_keyParts.isEmpty()) {
         qWarning() << "No key set.";
         m_lastError = ErrorNoKeySet;
-        return QByteArray();
+        return -1;
     }
+    return plaintextSizeOf(cyphertext, size, m_lastError);
+}
 
-    QByteArray ba = cypher;
-
-    if( cypher.count() < 3 )
-        return QByteArray();
+qint64 SimpleCrypt::plaintextSizeOf(const char *cyphertext, qint64 size, Error &error) const
+{
+    if (size >= blockHeaderSize && cyphertext[0] == 4) {
+        // the declared size is only trusted if the index matches the data
+        BlockCipher cipher(m_key, m_keyParts.constData());
+        QVector<quint64> ends;
+        if (!cipher.readLayout(cyphertext, size, ends, error))
+            return -1;
+        error = ErrorNoError;
+        return cipher.plainSize;
+    }
+    if (size < 3 || cyphertext[0] != 3) {
+        error = ErrorUnknownVersion;
+        return -1;
+    }
 
-    char version = ba.at(0);
+    CryptoFlags flags = CryptoFlags(uchar(cyphertext[1]));
+    if (!knownFlags(flags)) {
+        error = ErrorUnknownVersion;
+        return -1;
+    }
+    qint64 prefixSize = 3 + Integrity::size(flags);
+    CompressionCodec codec = CodecZlib;
+    if (flags.testFlag(CryptoFlagCompression) && !codecFromFlags(flags, codec)) {
+        error = ErrorUnsupportedCodec;
+        qWarning() << "Compressed with an unsupported codec.";
+        return -1;
+    }
+    if (!flags.testFlag(CryptoFlagCompression)) {
+        if (size < prefixSize) {
+            error = ErrorIntegrityFailed;
+            return -1;
+        }
+        error = ErrorNoError;
+        return size - prefixSize;
+    }
 
-    if (version !=3) {  //we only work with version 3
-        m_lastError = ErrorUnknownVersion;
-        qWarning() << "Invalid version or not a cyphertext.";
-        return QByteArray();
+    // the uncompressed size is the first thing in the compressed payload
+    if (size < prefixSize + 4) {
+        error = ErrorIntegrityFailed;
+        return -1;
     }
+    char lenHeader[4];
+    memcpy(lenHeader, cyphertext + prefixSize, 4);
+    char lastChar = cyphertext[prefixSize - 1];
+    decryptChain(lenHeader, 4, m_keyParts.constData(), prefixSize - 2, lastChar);
+    // the header isn't verified yet (and means nothing with a wrong key), so it's only trusted
+    // as far as the compressed data can expand
+    qint64 len = qFromBigEndian<quint32>(lenHeader);
+    if (len > decompressBound(codec, size - prefixSize - 4)) {
+        error = ErrorIntegrityFailed;
+        return -1;
+    }
+    error = ErrorNoError;
+    return len;
+}
 
-    CryptoFlags flags = CryptoFlags(ba.at(1));
+qint64 SimpleCrypt::decrypt(const char *cyphertext, qint64 size, char *plaintext, qint64 capacity)
+{
+    if (m_keyParts.isEmpty()) {
+        qWarning() << "No key set.";
+        m_lastError = ErrorNoKeySet;
+        return -1;
+    }
+    return decryptTo(cyphertext, size, plaintext, capacity, m_lastError);
+}
 
-    ba = ba.mid(2);
-    int pos(0);
-    int cnt(ba.count());
-    char lastChar = 0;
+qint64 SimpleCrypt::decryptTo(const char *cyphertext, qint64 size, char *plaintext, qint64 capacity, Error &error) const
+{
+    if (size >= blockHeaderSize && cyphertext[0] == 4) {
+        BlockCipher cipher(m_key, m_keyParts.constData());
+        QVector<quint64> ends;
+        if (!cipher.readLayout(cyphertext, size, ends, error))
+            return -1;
+        qint64 resultSize = cipher.plainSize;
+        if (capacity < resultSize) {
+            error = ErrorBufferTooSmall;
+            return -1;
+        }
+        std::vector<char> copy;
+        if (plaintext < cyphertext + size && cyphertext < plaintext + resultSize) {
+            copy.assign(cyphertext, cyphertext + size);
+            cyphertext = copy.data();
+        }
+        if (!cipher.decryptBlocks(0, cipher.blockCount, ends.constData(), 0, cyphertext + cipher.dataStart(), plaintext)) {
+            error = ErrorIntegrityFailed;
+            return -1;
+        }
+        error = ErrorNoError;
+        return resultSize;
+    }
 
-    while (pos < cnt) {
-        char currentChar = ba[pos];
-        ba[pos] = ba.at(pos) ^ lastChar ^ m_keyParts.at(pos % 8);
-        lastChar = currentChar;
-        ++pos;
+    qint64 resultSize = plaintextSizeOf(cyphertext, size, error);
+    if (resultSize < 0)
+        return -1;
+    if (capacity < resultSize) {
+        error = ErrorBufferTooSmall;
+        return -1;
     }
 
-    ba = ba.mid(1); //chop off the random number at the start
+    CryptoFlags flags = CryptoFlags(uchar(cyphertext[1]));
+    int integritySize = Integrity::size(flags);
+    qint64 prefixSize = 3 + integritySize;
+    const char* payload = cyphertext + prefixSize;
+    qint64 payloadSize = size - prefixSize;
 
-    bool integrityOk(true);
-    if (flags.testFlag(CryptoFlagChecksum)) {
-        if (ba.length() < 2) {
-            m_lastError = ErrorIntegrityFailed;
-            return QByteArray();
+    char prefix[1 + Integrity::maxSize];
+    memcpy(prefix, cyphertext + 2, size_t(1 + integritySize));
+    char lastChar = 0;
+    decryptChain(prefix, 1 + integritySize, m_keyParts.constData(), 0, lastChar);
+    Integrity integrity(flags, m_keyParts.constData());
+
+    if (!flags.testFlag(CryptoFlagCompression)) {
+        // Copying, decryption and the integrity check are done tile by tile,
+        // so the data is read from the memory only once.
+        // A plaintext that overlaps the cyphertext from behind must be moved in one go.
+        bool moveFirst = plaintext > payload && plaintext < payload + payloadSize;
+        if (moveFirst)
+            memmove(plaintext, payload, size_t(payloadSize));
+        for (qint64 pos = 0; pos < payloadSize; pos += tileSize) {
+            qint64 n = qMin(tileSize, payloadSize - pos);
+            if (!moveFirst)
+                memmove(plaintext + pos, payload + pos, size_t(n));
+            decryptChain(plaintext + pos, n, m_keyParts.constData(), prefixSize - 2 + pos, lastChar);
+            integrity.add(plaintext + pos, n);
         }
-        quint16 storedChecksum;
-        {
-            QDataStream s(&ba, QIODevice::ReadOnly);
-            s >> storedChecksum;
+        if (!integrity.matches(prefix + 1)) {
+            error = ErrorIntegrityFailed;
+            return -1;
         }
-        ba = ba.mid(2);
-        quint16 checksum = qChecksum(ba.constData(), ba.length());
-        integrityOk = (checksum == storedChecksum);
-    } else if (flags.testFlag(CryptoFlagHash)) {
-        if (ba.length() < 20) {
-            m_lastError = ErrorIntegrityFailed;
-            return QByteArray();
+        error = ErrorNoError;
+        return payloadSize;
+    }
+
+    // the compressed payload is decrypted piece by piece into a small buffer and decompressed from there
+    CompressionCodec codec = CodecZlib;
+    codecFromFlags(flags, codec);
+    Decompressor decompressor(codec);
+    Decompressor::Status status = Decompressor::More;
+    char buf[4096];
+    char* out = plaintext;
+    qint64 outLen = resultSize;
+    qint64 pos = 0;
+    while (pos < payloadSize && status != Decompressor::Corrupted) {
+        qint64 n = qMin<qint64>(sizeof(buf), payloadSize - pos);
+        memcpy(buf, payload + pos, size_t(n));
+        decryptChain(buf, n, m_keyParts.constData(), prefixSize - 2 + pos, lastChar);
+        integrity.add(buf, n);
+        qint64 skip = qMax<qint64>(0, 4 - pos);
+        pos += n;
+        const char* in = buf + skip;
+        qint64 inLen = n - skip;
+        while (inLen > 0 && status == Decompressor::More) {
+            qint64 inBefore = inLen;
+            qint64 outBefore = outLen;
+            status = decompressor.run(in, inLen, out, outLen);
+            if (inLen == inBefore && outLen == outBefore)
+                break; // more data than announced
         }
-        QByteArray storedHash = ba.left(20);
-        ba = ba.mid(20);
-        QCryptographicHash hash(QCryptographicHash::Sha1);
-        hash.addData(ba);
-        integrityOk = (hash.result() == storedHash);
     }
 
-    if (!integrityOk) {
-        m_lastError = ErrorIntegrityFailed;
+    if (status == Decompressor::Corrupted || !integrity.matches(prefix + 1) || !decompressor.isComplete() || outLen) {
+        error = ErrorIntegrityFailed;
+        return -1;
+    }
+    error = ErrorNoError;
+    return resultSize;
+}
+
+QByteArray SimpleCrypt::decryptRange(const QByteArray &cypher, qint64 offset, qint64 size)
+{
+    if (m_keyParts.isEmpty()) {
+        qWarning() << "No key set.";
+        m_lastError = ErrorNoKeySet;
+        return QByteArray();
+    }
+
+    if (cypher.isEmpty() || cypher.at(0) != 4) {
+        // version 3 can only be decrypted as a whole
+        QByteArray plain = decryptToByteArray(cypher);
+        offset = qBound<qint64>(0, offset, plain.size());
+        return plain.mid(int(offset), size < 0 ? -1 : int(qMin<qint64>(size, plain.size() - offset)));
+    }
+
+    BlockReader read = [&cypher](qint64 pos, char* data, qint64 len) {
+        if (pos + len > cypher.size())
+            return ErrorIntegrityFailed;
+        memcpy(data, cypher.constData() + pos, size_t(len));
+        return ErrorNoError;
+    };
+    BlockCipher cipher(m_key, m_keyParts.constData());
+    return decryptBlockRange(cipher, read, offset, size, m_lastError);
+}
+
+QByteArray SimpleCrypt::decryptRange(QIODevice *in, qint64 offset, qint64 size)
+{
+    if (m_keyParts.isEmpty()) {
+        qWarning() << "No key set.";
+        m_lastError = ErrorNoKeySet;
         return QByteArray();
     }
 
-    if (flags.testFlag(CryptoFlagCompression))
-        ba = qUncompress(ba);
+    char version = 0;
+    if (in->isSequential() || in->peek(&version, 1) != 1 || version != 4)
+        return decryptRange(in->readAll(), offset, size);
+
+    qint64 start = in->pos();
+    BlockReader read = [in, start](qint64 pos, char* data, qint64 len) {
+        if (!in->seek(start + pos))
+            return ErrorIO;
+        qint64 n = readFully(in, data, len);
+        return n < 0 ? ErrorIO : n < len ? ErrorIntegrityFailed : ErrorNoError;
+    };
+    BlockCipher cipher(m_key, m_keyParts.constData());
+    return decryptBlockRange(cipher, read, offset, size, m_lastError);
+}
+
+SimpleCrypt::BatchResult SimpleCrypt::encryptBatch(const QByteArrayList &plaintexts)
+{
+    int count = plaintexts.size();
+    BatchResult result;
+    result.offsets.fill(0, count + 1);
+    if (m_keyParts.isEmpty()) {
+        qWarning() << "No key set.";
+        m_lastError = ErrorNoKeySet;
+        result.errors.fill(ErrorNoKeySet, count);
+        return result;
+    }
+    m_lastError = ErrorNoError;
+    result.errors.fill(ErrorNoError, count);
+
+    // the items that don't fit into the QByteArray anymore get empty slots
+    QVector<qint64> slots(count + 1);
+    slots[0] = 0;
+    for (int i = 0; i < count; i++)
+        slots[i + 1] = slots.at(i) + batchSlotSize(requiredCiphertextSize(plaintexts.at(i).size()), slots.at(i), result.errors[i]);
+    result.data.resize(int(slots.at(count)));
+
+    QVector<qint64> sizes(count);
+    char* arena = result.data.data();
+    Error* errors = result.errors.data();
+    qint64* sizesData = sizes.data();
+    const qint64* slotsData = slots.constData();
+    QVector<BatchGroup> groups = batchGroups(plaintexts);
+    QtConcurrent::blockingMap(groups, [&](BatchGroup& group) {
+        for (int i = group.first; i < group.last; i++) {
+            if (errors[i] != ErrorNoError) {
+                sizesData[i] = 0;
+                continue;
+            }
+            const QByteArray& item = plaintexts.at(i);
+            sizesData[i] = encryptTo(item.constData(), item.size(), arena + slotsData[i], slotsData[i + 1] - slotsData[i], errors[i]);
+        }
+    });
+
+    compactBatch(result, slots, sizes);
+    return result;
+}
 
+SimpleCrypt::BatchResult SimpleCrypt::decryptBatch(const QByteArrayList &cyphertexts)
+{
+    int count = cyphertexts.size();
+    BatchResult result;
+    result.offsets.fill(0, count + 1);
+    if (m_keyParts.isEmpty()) {
+        qWarning() << "No key set.";
+        m_lastError = ErrorNoKeySet;
+        result.errors.fill(ErrorNoKeySet, count);
+        return result;
+    }
     m_lastError = ErrorNoError;
-    return ba;
+    result.errors.fill(ErrorNoError, count);
+
+    // the exact sizes are known upfront; bad headers and the items that don't fit get empty slots
+    QVector<qint64> slots(count + 1);
+    slots[0] = 0;
+    for (int i = 0; i < count; i++) {
+        const QByteArray& item = cyphertexts.at(i);
+        qint64 size = plaintextSizeOf(item.constData(), item.size(), result.errors[i]);
+        slots[i + 1] = slots.at(i) + (size < 0 ? 0 : batchSlotSize(size, slots.at(i), result.errors[i]));
+    }
+    result.data.resize(int(slots.at(count)));
+
+    QVector<qint64> sizes(count);
+    char* arena = result.data.data();
+    Error* errors = result.errors.data();
+    qint64* sizesData = sizes.data();
+    const qint64* slotsData = slots.constData();
+    QVector<BatchGroup> groups = batchGroups(cyphertexts);
+    QtConcurrent::blockingMap(groups, [&](BatchGroup& group) {
+        for (int i = group.first; i < group.last; i++) {
+            if (errors[i] != ErrorNoError) {
+                sizesData[i] = 0;
+                continue;
+            }
+            const QByteArray& item = cyphertexts.at(i);
+            sizesData[i] = decryptTo(item.constData(), item.size(), arena + slotsData[i], slotsData[i + 1] - slotsData[i], errors[i]);
+        }
+    });
+
+    compactBatch(result, slots, sizes);
+    return result;
+}
+
+QStringList SimpleCrypt::encryptToStringBatch(const QStringList &plaintexts, QVector<Error> *errors)
+{
+    QByteArrayList plaintextArrays;
+    plaintextArrays.reserve(plaintexts.size());
+    for (const QString& plaintext : plaintexts)
+        plaintextArrays.append(plaintext.toUtf8());
+
+    BatchResult batch = encryptBatch(plaintextArrays);
+    QStringList cypherStrings;
+    cypherStrings.reserve(batch.count());
+    for (int i = 0; i < batch.count(); i++)
+        cypherStrings.append(toBase64String(batch.itemData(i), batch.itemSize(i)));
+    if (errors)
+        *errors = batch.errors;
+    return cypherStrings;
+}
+
+QStringList SimpleCrypt::decryptToStringBatch(const QStringList &cyphertexts, QVector<Error> *errors)
+{
+    QByteArrayList cyphertextArrays;
+    cyphertextArrays.reserve(cyphertexts.size());
+    for (const QString& cyphertext : cyphertexts)
+        cyphertextArrays.append(fromBase64String(cyphertext));
+
+    BatchResult batch = decryptBatch(cyphertextArrays);
+    QStringList plaintexts;
+    plaintexts.reserve(batch.count());
+    for (int i = 0; i < batch.count(); i++)
+        plaintexts.append(QString::fromUtf8(batch.itemData(i), int(batch.itemSize(i))));
+    if (errors)
+        *errors = batch.errors;
+    return plaintexts;
 }
@@ -30,6 +30,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QString>
 #include <QVector>
 #include <QFlags>
+#include <QIODevice>
+#include <QByteArrayList>
+#include <QStringList>
 
 /**
   @short Simple encryption and decryption of strings and byte arrays
@@ -66,6 +69,14 @@ public:
         CompressionAlways,  /*!< Always apply compression. Note that for short inputs, a compression may result in longer data */
         CompressionNever    /*!< Never apply compression. */
     };
+    /**
+      CompressionCodec describes the algorithm used when compression is applied.
+      */
+    enum CompressionCodec {
+        CodecZlib, /*!< zlib, the same as qCompress(). Always available. Levels 0-9, the default is 9. */
+        CodecZstd, /*!< Zstandard. Needs SIMPLECRYPT_ZSTD. Levels 1-22, the default is 3. */
+        CodecLz4   /*!< LZ4 frame format. Needs SIMPLECRYPT_LZ4. Levels 0-12 (3 and above is LZ4 HC), the default is 0. */
+    };
     /**
       IntegrityProtectionMode describes measures taken to make it possible to detect problems with the data
       or wrong decryption keys.
@@ -77,7 +88,10 @@ public:
     enum IntegrityProtectionMode {
         ProtectionNone,    /*!< The integerity of the encrypted data is not protected. It is not really possible to detect a wrong key, for instance. */
         ProtectionChecksum,/*!< A simple checksum is used to verify that the data is in order. If not, an empty string is returned. */
-        ProtectionHash     /*!< A cryptographic hash is used to verify the integrity of the data. This method produces a much stronger, but longer check */
+        ProtectionHash,    /*!< A cryptographic hash is used to verify the integrity of the data. This method produces a much stronger, but longer check */
+        ProtectionCrc32c,  /*!< A 32-bit CRC32C, computed with the CPU's CRC instructions when available. A fast replacement for ProtectionChecksum. */
+        ProtectionXxh64,   /*!< A 64-bit XXH64 hash. Fast and catches practically all corruptions, but doesn't protect against deliberate changes. */
+        ProtectionBlake3   /*!< A BLAKE3 hash keyed with the encryption key. A much faster replacement for ProtectionHash. */
     };
     /**
       Error describes the type of error that occured.
@@ -87,6 +101,48 @@ public:
         ErrorNoKeySet,        /*!< No key was set. You can not encrypt or decrypt without a valid key. */
         ErrorUnknownVersion,  /*!< The version of this data is unknown, or the data is otherwise not valid. */
         ErrorIntegrityFailed, /*!< The integrity check of the data failed. Perhaps the wrong key was used. */
+        ErrorIO,              /*!< Reading from or writing to a device failed. */
+        ErrorBufferTooSmall,  /*!< The output buffer can't hold the result. */
+        ErrorUnsupportedCodec /*!< The data was compressed with a codec that this build doesn't support. */
+    };
+
+    //enum to describe options that have been used for the encryption. Currently only one, but
+    //that only leaves room for future extensions like adding a cryptographic hash...
+    enum CryptoFlag{CryptoFlagNone = 0,
+                    CryptoFlagCompression = 0x01,
+                    CryptoFlagChecksum = 0x02,
+                    CryptoFlagHash = 0x04,
+                    // The codec and the newer integrity methods are numbers in their own bits
+                    // (compare flags & mask with a value, testFlag() doesn't work for them).
+                    // The codec of CryptoFlagCompression; 0 means zlib.
+                    CryptoFlagCodecMask = 0x18,
+                    CryptoFlagZstd = 0x08,
+                    CryptoFlagLz4 = 0x10,
+                    // The integrity method when neither CryptoFlagChecksum nor CryptoFlagHash is set.
+                    CryptoFlagIntegrityMask = 0xE0,
+                    CryptoFlagCrc32c = 0x20,
+                    CryptoFlagXxh64 = 0x40,
+                    CryptoFlagBlake3 = 0x60
+                   };
+    Q_DECLARE_FLAGS(CryptoFlags, CryptoFlag)
+
+    /**
+      BatchResult holds the outputs of encryptBatch() and decryptBatch(),
+      stored back to back in a single buffer.
+      */
+    struct BatchResult
+    {
+        QByteArray data;         /*!< All outputs, back to back. */
+        QVector<qint64> offsets; /*!< Item i spans from offsets[i] to offsets[i + 1], so there is one more offset than items. */
+        QVector<Error> errors;   /*!< ErrorNoError, or the reason why item i is empty. */
+
+        int count() const {return errors.size();}
+        qint64 itemSize(int i) const {return offsets.at(i + 1) - offsets.at(i);}
+        const char* itemData(int i) const {return data.constData() + offsets.at(i);}
+        /**
+          Returns item @arg i as a QByteArray that shares the memory of this BatchResult.
+          */
+        QByteArray item(int i) const {return QByteArray::fromRawData(itemData(i), int(itemSize(i)));}
     };
 
     /**
@@ -123,6 +179,28 @@ public:
       */
     CompressionMode compressionMode() const {return m_compressionMode;}
 
+    /**
+      Sets the compression codec and its @arg level (-1 means the codec's default) to use when encrypting data.
+      The default is CodecZlib with level 9.
+      Returns false and keeps the current codec if @arg codec is not available in this build.
+
+      With CompressionAuto, the beginning of large inputs is checked first, and the compression
+      is not even attempted if the data looks like it's already compressed or encrypted.
+      */
+    bool setCompressionCodec(CompressionCodec codec, int level = -1);
+    /**
+      Returns the CompressionCodec that is currently in use.
+      */
+    CompressionCodec compressionCodec() const {return m_codec;}
+    /**
+      Returns the compression level that is currently in use.
+      */
+    int compressionLevel() const {return m_compressionLevel;}
+    /**
+      Returns true if @arg codec can be used for compression and decompression in this build.
+      */
+    static bool isCodecAvailable(CompressionCodec codec);
+
     /**
       Sets the integrity mode to use when encrypting data. The default mode is Checksum.
 
@@ -135,6 +213,28 @@ public:
       */
     IntegrityProtectionMode integrityProtectionMode() const {return m_protectionMode;}
 
+    /**
+      Sets the size of the blocks of the block-based format (version 4). The default, 0, keeps the version 3 format.
+      Other sizes are bound to minBlockSize and maxBlockSize.
+
+      In the block-based format, the data is split into blocks that are encrypted independently,
+      each with its own key and seed, and an index of the blocks precedes them.
+      So large data is encrypted and decrypted on all cores, and decryptRange() only has to
+      read and decrypt the blocks that it needs. Every block is compressed and protected on its own,
+      which costs some compression ratio and some space with small blocks.
+
+      Note that decryption is not influenced by this setting, as the decryption recognizes
+      the format that was used when encrypting.
+      */
+    void setBlockSize(int size);
+    /**
+      Returns the block size that is currently in use, 0 for the version 3 format.
+      */
+    int blockSize() const {return m_blockSize;}
+
+    static const int minBlockSize = 4 * 1024;
+    static const int maxBlockSize = 64 * 1024 * 1024;
+
     /**
       Returns the last error that occurred.
       */
@@ -202,22 +302,125 @@ public:
       */
     QByteArray decryptToByteArray(QByteArray cypher) ;
 
-    //enum to describe options that have been used for the encryption. Currently only one, but
-    //that only leaves room for future extensions like adding a cryptographic hash...
-    enum CryptoFlag{CryptoFlagNone = 0,
-                    CryptoFlagCompression = 0x01,
-                    CryptoFlagChecksum = 0x02,
-                    CryptoFlagHash = 0x04
-                   };
-    Q_DECLARE_FLAGS(CryptoFlags, CryptoFlag)
+    /**
+      Encrypts all data that can be read from @arg in and writes the binary cyphertext to @arg out.
+
+      The result is the same as the one of encryptToByteArray(), but the data is processed
+      chunk by chunk, so the memory use doesn't depend on the data size.
+      The integrity protection precedes the data in the cyphertext, therefore the input is read twice:
+      a sequential @arg in is spooled to a temporary file first, and so is the compressed data.
+      The spooled data is encrypted with a random key that is never stored anywhere.
+      Without a block size, data of 4 GiB or more can't be compressed: it's stored as is
+      with CompressionAuto, and ErrorBufferTooSmall is returned with CompressionAlways.
+      With a block size set, groups of blocks are encrypted in parallel instead, and the index of the blocks
+      is written afterwards if @arg out is seekable; otherwise the blocks are spooled to a temporary file.
+      */
+    bool encrypt(QIODevice* in, QIODevice* out);
+    /**
+      Decrypts a binary cyphertext read from @arg in and writes the plain text to @arg out
+      chunk by chunk.
+
+      The integrity can only be verified after all data has been processed, so if false is returned,
+      @arg out may already contain nonsense and should be discarded.
+      The blocks of the block-based format are verified one by one and decrypted in parallel, group by group.
+      */
+    bool decrypt(QIODevice* in, QIODevice* out);
+
+    /**
+      Returns the size of the output buffer that encrypt() needs for @arg plaintextSize bytes
+      of plain text when encrypting with the given @arg flags and @arg blockSize (see setBlockSize()).
+      With CryptoFlagCompression the worst case of the compression (with the codec from the flags) is taken into account.
+      */
+    static qint64 requiredCiphertextSize(qint64 plaintextSize, CryptoFlags flags, int blockSize = 0);
+    /**
+      Returns the size of the output buffer that encrypt() needs for @arg plaintextSize bytes
+      of plain text with the current compression and integrity protection modes and block size.
+      */
+    qint64 requiredCiphertextSize(qint64 plaintextSize) const;
+    /**
+      Encrypts @arg size bytes of @arg plaintext into the caller's @arg cyphertext buffer of @arg capacity bytes
+      and returns the length of the cyphertext, or -1 on error.
+      The result is the same as the one of encryptToByteArray().
+
+      @arg capacity must be at least requiredCiphertextSize(size).
+      Nothing is allocated unless compression, ProtectionHash or ProtectionBlake3 is used.
+      @arg plaintext may overlap @arg cyphertext (e.g. for in-place encryption). That costs nothing if compression is off;
+      otherwise an overlapping @arg plaintext is copied first.
+      With a block size set, the blocks are encrypted in parallel and an overlapping @arg plaintext is copied first.
+      */
+    qint64 encrypt(const char* plaintext, qint64 size, char* cyphertext, qint64 capacity);
+    /**
+      Returns the length of the plain text that @arg size bytes of @arg cyphertext decrypt to,
+      or -1 if it's not a valid cyphertext.
+      */
+    qint64 plaintextSize(const char* cyphertext, qint64 size);
+    /**
+      Decrypts @arg size bytes of @arg cyphertext into the caller's @arg plaintext buffer of @arg capacity bytes
+      and returns the length of the plain text, or -1 on error.
+
+      @arg capacity must be at least plaintextSize(cyphertext, size).
+      Nothing is allocated unless compression, ProtectionHash or ProtectionBlake3 was used.
+      If compression was off, @arg plaintext may point into @arg cyphertext (e.g. for in-place decryption).
+      The blocks of the block-based format are decrypted in parallel, and an overlapping @arg cyphertext is copied first.
+      */
+    qint64 decrypt(const char* cyphertext, qint64 size, char* plaintext, qint64 capacity);
+
+    /**
+      Decrypts @arg size bytes (-1 means up to the end) of the plain text starting at @arg offset
+      from the binary @arg cypher. The range is cut to the size of the plain text.
+
+      For the block-based format (see setBlockSize()) only the blocks that contain the range are decrypted,
+      and only their integrity is verified. Version 3 data is decrypted as a whole.
+      */
+    QByteArray decryptRange(const QByteArray& cypher, qint64 offset, qint64 size = -1);
+    /**
+      The same as above, but the cyphertext is read from the current position of @arg in.
+      For the block-based format, a random-access @arg in is read only where needed, and its position is undefined afterwards.
+      */
+    QByteArray decryptRange(QIODevice* in, qint64 offset, qint64 size = -1);
+
+    /**
+      Encrypts all @arg plaintexts in parallel on the global thread pool.
+      The result is the same as calling encryptToByteArray() for each of them.
+
+      Small items are handled in groups, so that the threading overhead doesn't dominate.
+      lastError() is only set to ErrorNoKeySet or ErrorNoError, the errors of the items are in the result.
+      The total size of the result is limited by what a QByteArray can hold,
+      the items that don't fit anymore are left empty with ErrorBufferTooSmall.
+      */
+    BatchResult encryptBatch(const QByteArrayList& plaintexts);
+    /**
+      Decrypts all @arg cyphertexts in parallel on the global thread pool.
+      Works the same way as encryptBatch().
+      */
+    BatchResult decryptBatch(const QByteArrayList& cyphertexts);
+    /**
+      The batch variant of encryptToString(). The errors of the items are stored in @arg errors if it's not null.
+      */
+    QStringList encryptToStringBatch(const QStringList& plaintexts, QVector<Error>* errors = nullptr);
+    /**
+      The batch variant of decryptToString(). The errors of the items are stored in @arg errors if it's not null.
+      */
+    QStringList decryptToStringBatch(const QStringList& cyphertexts, QVector<Error>* errors = nullptr);
+
 private:
 
     void splitKey();
+    CryptoFlags integrityFlag() const;
+    // the integrity flag and, unless compression is off, the compression and codec flags
+    CryptoFlags encryptionFlags() const;
+    // the same as the public variants, but they don't touch m_lastError, so they can run in parallel
+    qint64 encryptTo(const char* plaintext, qint64 size, char* cyphertext, qint64 capacity, Error& error) const;
+    qint64 plaintextSizeOf(const char* cyphertext, qint64 size, Error& error) const;
+    qint64 decryptTo(const char* cyphertext, qint64 size, char* plaintext, qint64 capacity, Error& error) const;
 
     quint64 m_key;
     QVector<char> m_keyParts;
     CompressionMode m_compressionMode;
+    CompressionCodec m_codec;
+    int m_compressionLevel;
     IntegrityProtectionMode m_protectionMode;
+    int m_blockSize;
     Error m_lastError;
 };
 Q_DECLARE_OPERATORS_FOR_FLAGS(SimpleCrypt::CryptoFlags)